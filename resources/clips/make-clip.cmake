@@ -0,0 +1,19 @@
+# Encode the clip of a video codec for the decoder probe, see src/codec-probe.c.
+# Called with -DGST_LAUNCH=<gst-launch-1.0> -DENCODER=<element and properties>
+# -DOUTPUT=<file>. If the build host cannot encode it, the clip is left empty and
+# the codec is ranked after the measured ones.
+
+set(SOURCE videotestsrc pattern=ball num-buffers=30
+    ! video/x-raw,format=I420,width=640,height=360,framerate=25/1)
+separate_arguments(ENCODER)
+
+set(RESULT 1)
+if (GST_LAUNCH)
+    execute_process(COMMAND ${GST_LAUNCH} -q ${SOURCE} ! ${ENCODER}
+                            ! matroskamux ! filesink location=${OUTPUT}
+                    RESULT_VARIABLE RESULT OUTPUT_QUIET ERROR_QUIET)
+endif ()
+if (NOT RESULT EQUAL 0)
+    message(WARNING "Could not encode ${OUTPUT} with ${ENCODER}")
+    file(WRITE ${OUTPUT} "")
+endif ()
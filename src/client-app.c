@@ -27,6 +27,9 @@
 #include "configuration.h"
 #include "client-win.h"
 #include "client-request.h"
+#include "client-timeline.h"
+#include "codec-probe.h"
+#include "client-scheduler.h"
 #include "client-conn.h"
 #include "spice-win.h"
 #include "flexvdi-port.h"
@@ -82,6 +85,15 @@ struct _ClientApp {
     gboolean autologin;
     gboolean grab_disabled;
     PrintJobManager * pjb;
+    ClientScheduler * scheduler;
+    guint keep_warm_id;
+    guint desktop_retry_id;
+    guint inactivity_id;
+    guint ungrab_id;
+    gint64 desktop_poll_deadline;
+    guint desktop_poll_delay;
+    gboolean timeline_logged;
+    GArray * video_codecs;
 };
 
 G_DEFINE_TYPE(ClientApp, client_app, GTK_TYPE_APPLICATION);
@@ -91,6 +103,7 @@ static gboolean client_app_local_command_line(GApplication * gapp, gchar *** arg
                                               int * exit_status);
 static void client_app_startup(GApplication * gapp);
 static void client_app_activate(GApplication * gapp);
+static void client_app_shutdown(GApplication * gapp);
 static void client_app_open(GApplication * application, GFile ** files,
                             gint n_files, const gchar * hint);
 static void open_with_default_app(PrintJobManager * pjb, const char * file);
@@ -99,6 +112,7 @@ static void client_app_class_init(ClientAppClass * class) {
     G_APPLICATION_CLASS(class)->local_command_line = client_app_local_command_line;
     G_APPLICATION_CLASS(class)->startup = client_app_startup;
     G_APPLICATION_CLASS(class)->activate = client_app_activate;
+    G_APPLICATION_CLASS(class)->shutdown = client_app_shutdown;
     G_APPLICATION_CLASS(class)->open = client_app_open;
 }
 
@@ -118,13 +132,12 @@ static void client_app_init(ClientApp * app) {
 
     // Create the configuration object. Reads options from config file.
     app->conf = client_conf_new();
+    // Housekeeping timers
+    app->scheduler = client_scheduler_new();
     app->username = app->password = app->desktop = "";
     app->desktops = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
     app->autologin = TRUE;
 
-    app->pjb = print_job_manager_new();
-    g_signal_connect(app->pjb, "pdf", G_CALLBACK(open_with_default_app), NULL);
-
     // Sets valid command-line options
     client_conf_set_application_options(app->conf, G_APPLICATION(app));
     g_application_add_option_group(G_APPLICATION(app), gst_init_get_option_group());
@@ -132,6 +145,7 @@ static void client_app_init(ClientApp * app) {
     g_application_set_option_context_summary(G_APPLICATION(app),
         "flexVDI Client is a Virtual Desktop client for flexVDI platforms. "
         "It can also be used as a generic Spice client providing a Spice URI on the command line.");
+    client_log_startup_mark("app init");
 }
 
 
@@ -156,10 +170,15 @@ static gboolean key_event_handler(GtkWidget * widget, GdkEvent * event, gpointer
 static void desktop_selected_handler(ClientAppWindow * win, gpointer user_data);
 static gboolean delete_cb(GtkWidget * widget, GdkEvent * event, gpointer user_data);
 static void network_changed(GNetworkMonitor * net_monitor, gboolean network_available, gpointer user_data);
+static gboolean first_draw_cb(GtkWidget * widget, cairo_t * cr, gpointer user_data);
+static gboolean client_app_finish_activation(gpointer user_data);
 
 static void client_app_configure(ClientApp * app, const gchar * error);
 static void client_app_show_login(ClientApp * app, const gchar * error);
+static void client_app_keep_connection_warm(ClientApp * app, gboolean keep);
+static void client_app_stop_desktop_polling(ClientApp * app);
 static void client_app_connect_with_spice_uri(ClientApp * app, const gchar * uri);
+static void client_app_choose_video_codecs(ClientApp * app);
 
 static void about_activated(GSimpleAction * action, GVariant * parameter, gpointer gapp) {
     ClientApp * app = CLIENT_APP(gapp);
@@ -195,6 +214,15 @@ static void client_app_startup(GApplication * gapp) {
 
     g_action_map_add_action_entries(G_ACTION_MAP(gapp), app_entries,
         G_N_ELEMENTS(app_entries), gapp);
+    client_log_startup_mark("app startup");
+}
+
+/*
+ * Shutdown application. Saves any pending configuration changes.
+ */
+static void client_app_shutdown(GApplication * gapp) {
+    client_conf_save(CLIENT_APP(gapp)->conf);
+    G_APPLICATION_CLASS(client_app_parent_class)->shutdown(gapp);
 }
 
 /*
@@ -204,14 +232,41 @@ static void client_app_startup(GApplication * gapp) {
 static void client_app_activate(GApplication * gapp) {
     ClientApp * app = CLIENT_APP(gapp);
     app->main_window = client_app_window_new(app, app->conf);
+    client_log_startup_mark("main window created");
     gtk_widget_show_all(GTK_WIDGET(app->main_window));
+    client_log_startup_mark("main window shown");
 
     if (client_conf_get_kiosk_mode(app->conf))
         client_app_window_hide_config_button(app->main_window);
 
+    // Defer everything else until the window is on screen
+    g_signal_connect_after(app->main_window, "draw",
+        G_CALLBACK(first_draw_cb), app);
+}
+
+/*
+ * First draw handler of the main window. The rest of the activation waits for
+ * the main loop to be idle, so that the first frame is not delayed.
+ */
+static gboolean first_draw_cb(GtkWidget * widget, cairo_t * cr, gpointer user_data) {
+    client_log_startup_mark("first frame");
+    g_signal_handlers_disconnect_by_func(widget, G_CALLBACK(first_draw_cb), user_data);
+    g_idle_add(client_app_finish_activation, user_data);
+    return FALSE;
+}
+
+/*
+ * Finish the activation, with the main window already shown: discover the terminal ID
+ * if it was not saved in the configuration file, and start connecting when the
+ * network is available.
+ */
+static gboolean client_app_finish_activation(gpointer user_data) {
+    ClientApp * app = CLIENT_APP(user_data);
+
     const gchar * tid = client_conf_get_terminal_id(app->conf);
     g_autofree gchar * text = g_strconcat("Terminal ID: ", tid, NULL);
     client_app_window_set_info(app->main_window, text);
+    client_log_startup_mark("terminal ID");
 
     g_signal_connect(app->main_window, "button-pressed",
         G_CALLBACK(button_pressed_handler), app);
@@ -234,6 +289,12 @@ static void client_app_activate(GApplication * gapp) {
         client_app_window_set_central_widget_sensitive(app->main_window, FALSE);
         g_signal_connect(net_monitor, "network-changed", G_CALLBACK(network_changed), app);
     }
+
+    client_app_choose_video_codecs(app);
+
+    client_log_startup_mark("activation");
+    client_log_startup_report(client_conf_get_startup_trace(app->conf));
+    return G_SOURCE_REMOVE;
 }
 
 static void network_changed(GNetworkMonitor * net_monitor, gboolean network_available, gpointer user_data) {
@@ -242,6 +303,7 @@ static void network_changed(GNetworkMonitor * net_monitor, gboolean network_avai
 
     g_debug("Network is available NOW");
     g_signal_handlers_disconnect_by_func(net_monitor, G_CALLBACK(network_changed), app);
+    client_conf_prefetch_dns(app->conf);
     if (client_conf_get_uri(app->conf) != NULL) {
         client_app_connect_with_spice_uri(app, client_conf_get_uri(app->conf));
         client_app_window_status(app->main_window, "Connecting to desktop...");
@@ -395,6 +457,8 @@ static void client_app_configure(ClientApp * app, const gchar * error) {
         client_request_cancel(app->current_request);
         g_clear_object(&app->current_request);
     }
+    client_app_keep_connection_warm(app, FALSE);
+    client_app_stop_desktop_polling(app);
 
     if (error != NULL) {
         client_app_window_error(app->main_window, error);
@@ -402,6 +466,31 @@ static void client_app_configure(ClientApp * app, const gchar * error) {
 }
 
 
+/*
+ * While the user is on the login or desktops page, keep a connection to the manager
+ * open, so that the desktop request does not need to set up a new one. The period
+ * is below the idle timeout of the SoupSession.
+ */
+#define KEEP_WARM_PERIOD 60
+
+static gboolean keep_connection_warm(gpointer user_data) {
+    ClientApp * app = CLIENT_APP(user_data);
+    client_conf_warm_up_connection(app->conf);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void client_app_keep_connection_warm(ClientApp * app, gboolean keep) {
+    if (keep && !app->keep_warm_id) {
+        app->keep_warm_id = client_scheduler_add_seconds(app->scheduler, KEEP_WARM_PERIOD,
+                                                         keep_connection_warm, app);
+    } else if (!keep && app->keep_warm_id) {
+        client_scheduler_remove(app->scheduler, app->keep_warm_id);
+        app->keep_warm_id = 0;
+    }
+}
+
+
 static void authmode_request_cb(ClientRequest * req, gpointer user_data);
 
 /*
@@ -418,12 +507,15 @@ static void client_app_show_login(ClientApp * app, const gchar * error) {
     client_app_window_set_central_widget_sensitive(app->main_window, FALSE);
 
     app->username = app->password = app->desktop = "";
+    client_app_stop_desktop_polling(app);
 
     g_clear_object(&app->current_request);
+    client_timeline_reset();
     g_autofree gchar * req_body = g_strdup_printf(
         "{\"hwaddress\": \"%s\"}", client_conf_get_terminal_id(app->conf));
-    app->current_request = client_request_new_with_data(app->conf,
+    app->current_request = client_request_race(app->conf,
         "/vdi/authmode", req_body, authmode_request_cb, app);
+    client_app_keep_connection_warm(app, TRUE);
 }
 
 
@@ -434,6 +526,7 @@ static void authmode_request_cb(ClientRequest * req, gpointer user_data) {
     ClientApp * app = CLIENT_APP(user_data);
     g_autoptr(GError) error = NULL;
     JsonNode * root = client_request_get_result(req, &error);
+    client_timeline_span(client_request_get_timings(req)->start, "authmode request");
 
     if (error) {
         client_app_configure(app, "Failed to contact server");
@@ -476,21 +569,79 @@ static void client_app_request_desktop(ClientApp * app) {
     client_app_window_set_central_widget_sensitive(app->main_window, FALSE);
 
     g_clear_object(&app->current_request);
+    // With long polling, the manager holds the request until the desktop is ready
+    int wait = client_conf_get_desktop_long_poll(app->conf);
+    g_autofree gchar * wait_member = wait > 0 ? g_strdup_printf(", \"wait\": %d", wait) : NULL;
     g_autofree gchar * req_body = g_strdup_printf(
-        "{\"hwaddress\": \"%s\", \"username\": \"%s\", \"password\": \"%s\", \"desktop\": \"%s\"}",
+        "{\"hwaddress\": \"%s\", \"username\": \"%s\", \"password\": \"%s\", \"desktop\": \"%s\"%s}",
         client_conf_get_terminal_id(app->conf),
-        app->username, app->password, app->desktop);
-    app->current_request = client_request_new_with_data(app->conf,
+        app->username, app->password, app->desktop, wait_member ? wait_member : "");
+    app->current_request = client_request_new_long_poll(app->conf,
         "/vdi/desktop", req_body, desktop_request_cb, app);
 }
 
 
 static gboolean client_app_repeat_request_desktop(gpointer user_data) {
-    client_app_request_desktop(CLIENT_APP(user_data));
+    ClientApp * app = CLIENT_APP(user_data);
+    app->desktop_retry_id = 0;
+    client_app_request_desktop(app);
     return FALSE; // Cancel timeout
 }
 
 
+/*
+ * Polling of a desktop that is being prepared: the delay between requests grows
+ * exponentially, with jitter so that clients that started at the same time do not
+ * poll the manager in lockstep. The manager may also suggest a delay with a
+ * "retry_after" member, in seconds.
+ */
+#define DESKTOP_POLL_MIN_DELAY 1000
+#define DESKTOP_POLL_MAX_DELAY 30000
+
+static void client_app_stop_desktop_polling(ClientApp * app) {
+    if (app->desktop_retry_id) {
+        client_scheduler_remove(app->scheduler, app->desktop_retry_id);
+        app->desktop_retry_id = 0;
+    }
+    app->desktop_poll_deadline = 0;
+}
+
+
+/*
+ * Schedule the next desktop request. Return FALSE if the deadline has passed.
+ */
+static gboolean client_app_schedule_desktop_retry(ClientApp * app, JsonObject * response) {
+    gint64 now = g_get_monotonic_time();
+    int timeout = client_conf_get_desktop_poll_timeout(app->conf);
+    guint delay;
+
+    if (!app->desktop_poll_deadline) {
+        app->desktop_poll_deadline = timeout > 0 ? now + timeout * G_USEC_PER_SEC : G_MAXINT64;
+        app->desktop_poll_delay = DESKTOP_POLL_MIN_DELAY;
+    } else if (now >= app->desktop_poll_deadline) {
+        client_app_stop_desktop_polling(app);
+        return FALSE;
+    }
+
+    if (json_object_has_member(response, "retry_after")) {
+        delay = MAX(0, json_object_get_int_member(response, "retry_after")) * 1000;
+    } else if (client_conf_get_desktop_long_poll(app->conf) > 0) {
+        // The manager already held the request
+        delay = DESKTOP_POLL_MIN_DELAY;
+    } else {
+        delay = app->desktop_poll_delay;
+        app->desktop_poll_delay = MIN(delay * 2, DESKTOP_POLL_MAX_DELAY);
+    }
+    // Half of the delay is random
+    delay = delay / 2 + g_random_int_range(0, delay / 2 + 1);
+    delay = MIN(delay, (app->desktop_poll_deadline - now) / 1000);
+    g_debug("Desktop is not ready, retrying in %u ms", delay);
+    app->desktop_retry_id = client_scheduler_add(app->scheduler, delay,
+                                                 client_app_repeat_request_desktop, app);
+    return TRUE;
+}
+
+
 static void client_app_show_desktops(ClientApp * app, JsonObject * desktop);
 static void client_app_connect_with_response(ClientApp * app, JsonObject * params);
 
@@ -502,6 +653,7 @@ static void desktop_request_cb(ClientRequest * req, gpointer user_data) {
     g_autoptr(GError) error = NULL;
     gboolean invalid = FALSE;
     JsonNode * root = client_request_get_result(req, &error);
+    client_timeline_span(client_request_get_timings(req)->start, "desktop request");
 
     if (error) {
         client_app_show_login(app, "Failed to contact server");
@@ -511,13 +663,17 @@ static void desktop_request_cb(ClientRequest * req, gpointer user_data) {
         JsonObject * response = json_node_get_object(root);
         const gchar * status = json_object_get_string_member(response, "status");
         if (g_strcmp0(status, "OK") == 0) {
+            client_timeline_mark("desktop ready");
             client_app_window_status(app->main_window, "Connecting to desktop...");
             client_app_connect_with_response(app, response);
 
         } else if (g_strcmp0(status, "Pending") == 0) {
-            client_app_window_status(app->main_window, "Preparing desktop...");
-            // Retry (forever) after 3 seconds
-            g_timeout_add_seconds(3, client_app_repeat_request_desktop, app);
+            if (client_app_schedule_desktop_retry(app, response)) {
+                client_app_window_status(app->main_window, "Preparing desktop...");
+            } else {
+                client_app_show_login(app, "The desktop is taking too long to start, try again later");
+                client_app_window_set_central_widget_sensitive(app->main_window, TRUE);
+            }
 
         } else if (g_strcmp0(status, "Error") == 0) {
             const gchar * message = json_object_get_string_member(response, "message");
@@ -560,6 +716,7 @@ static void client_app_show_desktops(ClientApp * app, JsonObject * desktops) {
     const gchar * desktop_key;
     JsonNode * desktop_node;
 
+    client_app_stop_desktop_polling(app);
     g_hash_table_remove_all(app->desktops);
     json_object_iter_init(&it, desktops);
     while (json_object_iter_next(&it, &desktop_key, &desktop_node)) {
@@ -583,6 +740,8 @@ static void client_app_show_desktops(ClientApp * app, JsonObject * desktops) {
 static void channel_new(SpiceSession * s, SpiceChannel * channel, gpointer user_data);
 static void connection_disconnected(ClientConn * conn, ClientConnDisconnectReason reason,
                                     gpointer user_data);
+static void connection_reconnecting(ClientConn * conn, gpointer user_data);
+static void connection_reconnected(ClientConn * conn, gpointer user_data);
 void usb_connect_failed(GObject * object, SpiceUsbDevice * device,
                         GError * error, gpointer user_data);
 static gboolean check_inactivity(gpointer user_data);
@@ -596,12 +755,22 @@ static gboolean check_ungrab(gpointer user_data);
  */
 static void client_app_connect(ClientApp * app) {
     SpiceSession * session = client_conn_get_session(app->connection);
+    app->timeline_logged = FALSE;
     client_conf_set_gtk_session_options(app->conf, G_OBJECT(spice_gtk_session_get(session)));
     g_signal_connect(session, "channel-new",
                      G_CALLBACK(channel_new), app);
     g_signal_connect(app->connection, "disconnected",
                      G_CALLBACK(connection_disconnected), app);
-
+    g_signal_connect(app->connection, "reconnecting",
+                     G_CALLBACK(connection_reconnecting), app);
+    g_signal_connect(app->connection, "reconnected",
+                     G_CALLBACK(connection_reconnected), app);
+
+    // The print job manager is not needed until the first connection
+    if (!app->pjb) {
+        app->pjb = print_job_manager_new(app->scheduler);
+        g_signal_connect(app->pjb, "pdf", G_CALLBACK(open_with_default_app), NULL);
+    }
     FlexvdiPort * guest_port = client_conn_get_guest_agent_port(app->connection);
     g_signal_connect_swapped(guest_port, "message",
                              G_CALLBACK(print_job_manager_handle_message), app->pjb);
@@ -621,8 +790,10 @@ static void client_app_connect(ClientApp * app) {
  * Get connection parameters from the desktop response
  */
 static void client_app_connect_with_response(ClientApp * app, JsonObject * params) {
+    client_app_keep_connection_warm(app, FALSE);
+    client_app_stop_desktop_polling(app);
     client_conf_get_options_from_response(app->conf, params);
-    app->connection = client_conn_new(app->conf, params);
+    app->connection = client_conn_new(app->conf, app->scheduler, params);
     client_app_connect(app);
 }
 
@@ -630,12 +801,16 @@ static void client_app_connect_with_response(ClientApp * app, JsonObject * param
  * Get connection parameters from the URI passed in the command line.
  */
 static void client_app_connect_with_spice_uri(ClientApp * app, const gchar * uri) {
-    app->connection = client_conn_new_with_uri(app->conf, uri);
+    client_timeline_reset();
+    app->connection = client_conn_new_with_uri(app->conf, app->scheduler, uri);
     client_app_connect(app);
 }
 
 
 static void display_monitors(SpiceChannel * display, GParamSpec * pspec, ClientApp * app);
+static void display_mark(SpiceChannel * channel, gint mark, ClientApp * app);
+static void display_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                  ClientApp * app);
 static void main_agent_update(SpiceChannel * channel, ClientApp * app);
 
 /*
@@ -658,10 +833,97 @@ static void channel_new(SpiceSession * s, SpiceChannel * channel, gpointer user_
     if (SPICE_IS_DISPLAY_CHANNEL(channel)) {
         g_signal_connect(channel, "notify::monitors",
                          G_CALLBACK(display_monitors), app);
+        g_signal_connect(channel, "display-mark",
+                         G_CALLBACK(display_mark), app);
+        g_signal_connect(channel, "channel-event",
+                         G_CALLBACK(display_channel_event), app);
     }
 }
 
 
+/*
+ * Send the preferred video codecs to a display channel, if they are already known.
+ */
+static void send_video_codecs(ClientApp * app, SpiceChannel * channel) {
+    if (!app->video_codecs || app->video_codecs->len == 0) return;
+    gint * codecs = (gint *)app->video_codecs->data;
+#if SPICE_GTK_CHECK_VERSION(0, 38, 0)
+    g_autoptr(GError) error = NULL;
+    if (!spice_display_channel_change_preferred_video_codec_types(
+            channel, codecs, app->video_codecs->len, &error))
+        g_debug("Cannot set the preferred video codecs: %s", error->message);
+#else
+    spice_display_channel_change_preferred_video_codec_type(channel, codecs[0]);
+#endif
+}
+
+
+static void display_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                  ClientApp * app) {
+    if (event == SPICE_CHANNEL_OPENED)
+        send_video_codecs(app, channel);
+}
+
+
+static void codec_probe_cb(GObject * source_object, GAsyncResult * res, gpointer user_data) {
+    ClientApp * app = CLIENT_APP(user_data);
+    g_autoptr(GError) error = NULL;
+    app->video_codecs = codec_probe_run_finish(res, &error);
+    if (!app->video_codecs) {
+        g_warning("Failed to probe the video decoders: %s", error->message);
+        return;
+    }
+    g_autofree gchar * key = codec_probe_get_key();
+    client_conf_set_video_codec_ranking(app->conf, key, app->video_codecs);
+
+    // Display channels may have opened while probing
+    if (app->connection) {
+        GList * channels = spice_session_get_channels(client_conn_get_session(app->connection)),
+            * channel;
+        for (channel = channels; channel != NULL; channel = channel->next) {
+            if (SPICE_IS_DISPLAY_CHANNEL(channel->data))
+                send_video_codecs(app, SPICE_CHANNEL(channel->data));
+        }
+        g_list_free(channels);
+    }
+}
+
+
+// Seconds after startup to probe the decoders, so that it does not slow down the login
+#define CODEC_PROBE_DELAY 60
+
+static gboolean start_codec_probe(gpointer user_data) {
+    codec_probe_run_async(NULL, codec_probe_cb, user_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * Get the preferred video codecs from the configuration or, by default, rank them
+ * by how fast they are decoded in this machine. The ranking is saved, and only
+ * probed again when GStreamer or its plugins change.
+ */
+static void client_app_choose_video_codecs(ClientApp * app) {
+    app->video_codecs = client_conf_get_preferred_video_codecs(app->conf);
+    if (app->video_codecs) return;
+    g_autofree gchar * key = codec_probe_get_key();
+    app->video_codecs = client_conf_get_video_codec_ranking(app->conf, key);
+    if (!app->video_codecs)
+        client_scheduler_add_seconds(app->scheduler, CODEC_PROBE_DELAY, start_codec_probe, app);
+}
+
+
+/*
+ * Save the connection timeline to the file given with --timeline-file, if any.
+ */
+static void client_app_save_timeline(ClientApp * app) {
+    const gchar * file_name = client_conf_get_timeline_file(app->conf);
+    g_autoptr(GError) error = NULL;
+    if (file_name && !client_timeline_save(file_name, &error))
+        g_warning("Failed to save the connection timeline: %s", error->message);
+}
+
+
 static void client_app_close_windows(ClientApp * app) {
     GList * windows = gtk_application_get_windows(GTK_APPLICATION(app)),
         * window = windows, * next;
@@ -693,6 +955,11 @@ static SpiceWindow * get_window_for_monitor(ClientApp * app, int monitor) {
 static void connection_disconnected(ClientConn * conn, ClientConnDisconnectReason reason,
                                     gpointer user_data) {
     ClientApp * app = CLIENT_APP(user_data);
+    // Save the events that happened after the first frame too
+    client_app_save_timeline(app);
+    client_scheduler_remove(app->scheduler, app->inactivity_id);
+    client_scheduler_remove(app->scheduler, app->ungrab_id);
+    app->inactivity_id = app->ungrab_id = 0;
 
     if (app->main_window) {
         client_app_show_login(app, "Failed to establish the connection, see the log file for further information.");
@@ -721,7 +988,28 @@ static void connection_disconnected(ClientConn * conn, ClientConnDisconnectReaso
 }
 
 
-static void spice_win_display_mark(SpiceChannel * channel, gint mark, SpiceWindow * win);
+/*
+ * Connection lost and restored handlers. The desktop windows stay open, showing
+ * that the connection is being restored.
+ */
+static void set_windows_reconnecting(ClientApp * app, gboolean reconnecting) {
+    GList * window = gtk_application_get_windows(GTK_APPLICATION(app));
+    for (; window != NULL; window = window->next)
+        if (SPICE_IS_WIN(window->data))
+            spice_win_set_reconnecting(SPICE_WIN(window->data), reconnecting);
+}
+
+
+static void connection_reconnecting(ClientConn * conn, gpointer user_data) {
+    set_windows_reconnecting(CLIENT_APP(user_data), TRUE);
+}
+
+
+static void connection_reconnected(ClientConn * conn, gpointer user_data) {
+    set_windows_reconnecting(CLIENT_APP(user_data), FALSE);
+}
+
+
 static void set_cp_sensitive(SpiceWindow * win, ClientApp * app);
 static void user_activity_cb(SpiceWindow * win, ClientApp * app);
 
@@ -751,11 +1039,10 @@ static void display_monitors(SpiceChannel * display, GParamSpec * pspec, ClientA
                 g_object_get(client_conn_get_session(app->connection), "name", &name, NULL);
             }
             g_autofree gchar * title = g_strdup_printf("%s - flexVDI Client", name);
-            SpiceWindow * win = spice_window_new(app->connection, display, app->conf, i, title);
+            SpiceWindow * win = spice_window_new(app->connection, app->conf, app->scheduler,
+                                                 i, title);
             // Inform GTK that this is an application window
             gtk_application_add_window(GTK_APPLICATION(app), GTK_WINDOW(win));
-            spice_g_signal_connect_object(display, "display-mark",
-                                          G_CALLBACK(spice_win_display_mark), win, 0);
             if (i == 0) {
                 g_signal_connect(win, "delete-event", G_CALLBACK(delete_cb), app);
 
@@ -786,11 +1073,28 @@ static void display_monitors(SpiceChannel * display, GParamSpec * pspec, ClientA
 }
 
 
-static void spice_win_display_mark(SpiceChannel * channel, gint mark, SpiceWindow * win) {
-    if (mark) {
-        gtk_widget_show(GTK_WIDGET(win));
-    } else {
-        gtk_widget_hide(GTK_WIDGET(win));
+/*
+ * Display mark handler. Shows or hides the desktop windows. Windows outlive their
+ * display channel when the connection is restored, so this is connected to every
+ * new display channel.
+ */
+static void display_mark(SpiceChannel * channel, gint mark, ClientApp * app) {
+    if (mark && !app->timeline_logged) {
+        // The session started
+        app->timeline_logged = TRUE;
+        client_timeline_log();
+        client_app_save_timeline(app);
+    }
+
+    GList * window = gtk_application_get_windows(GTK_APPLICATION(app));
+    for (; window != NULL; window = window->next) {
+        if (SPICE_IS_WIN(window->data)) {
+            if (mark) {
+                gtk_widget_show(GTK_WIDGET(window->data));
+            } else {
+                gtk_widget_hide(GTK_WIDGET(window->data));
+            }
+        }
     }
 }
 
@@ -851,12 +1155,15 @@ static void user_activity_cb(SpiceWindow * win, ClientApp * app) {
  * Check user inactivity:
  * - If there are still more than 30 seconds left until timeout, program another
  *   check at that moment.
- * - If there are less than 30 seconds left, program another check every 100ms and
- *   show a notification reporting that the session is about to expire.
+ * - If there are less than 30 seconds left, program another check when the count
+ *   of seconds changes and show a notification reporting that the session is about
+ *   to expire.
  * - If the timeout arrives, close the connection.
  */
 static gboolean check_inactivity(gpointer user_data) {
     ClientApp * app = CLIENT_APP(user_data);
+    client_scheduler_remove(app->scheduler, app->inactivity_id);
+    app->inactivity_id = 0;
     gint inactivity_timeout = client_conf_get_inactivity_timeout(app->conf);
     gint64 now = g_get_monotonic_time();
     gint time_to_inactivity = (app->last_input_time - now)/1000 + inactivity_timeout*1000;
@@ -864,16 +1171,18 @@ static gboolean check_inactivity(gpointer user_data) {
     if (time_to_inactivity <= 0) {
         client_conn_disconnect(app->connection, CLIENT_CONN_DISCONNECT_INACTIVITY);
     } else if (time_to_inactivity <= 30000) {
-        g_timeout_add(100, check_inactivity, app);
+        int seconds = (time_to_inactivity + 999) / 1000;
+        app->inactivity_id = client_scheduler_add(app->scheduler,
+            time_to_inactivity - (seconds - 1) * 1000, check_inactivity, app);
         GtkWindow * win = gtk_application_get_active_window(GTK_APPLICATION(app));
         if (win != NULL && SPICE_IS_WIN(win)) {
-            int seconds = (time_to_inactivity + 999) / 1000;
             g_autofree gchar * text = g_strdup_printf(
                 "Your session will end in %d seconds due to inactivity", seconds);
-            spice_win_show_notification(SPICE_WIN(win), text, 200);
+            spice_win_show_notification(SPICE_WIN(win), text, 1100);
         }
     } else {
-        g_timeout_add(time_to_inactivity - 30000, check_inactivity, app);
+        app->inactivity_id = client_scheduler_add(app->scheduler,
+            time_to_inactivity - 30000, check_inactivity, app);
     }
 
     return FALSE;
@@ -882,6 +1191,8 @@ static gboolean check_inactivity(gpointer user_data) {
 
 static gboolean check_ungrab(gpointer user_data) {
     ClientApp * app = CLIENT_APP(user_data);
+    client_scheduler_remove(app->scheduler, app->ungrab_id);
+    app->ungrab_id = 0;
     gint64 now = g_get_monotonic_time();
     // Ungrab after 55 seconds, to avoid race condition with a 1-minute screenlock timeout
     gint time_to_ungrab = (app->last_input_time - now)/1000 + 55000;
@@ -896,7 +1207,7 @@ static gboolean check_ungrab(gpointer user_data) {
         }
         app->grab_disabled = TRUE;
     } else {
-        g_timeout_add(time_to_ungrab, check_ungrab, app);
+        app->ungrab_id = client_scheduler_add(app->scheduler, time_to_ungrab, check_ungrab, app);
     }
 
     return FALSE;
@@ -19,6 +19,8 @@
 
 #include "client-conn.h"
 #include "ws-tunnel.h"
+#include "client-timeline.h"
+#include "compression-monitor.h"
 #ifdef ENABLE_SERIALREDIR
 #include "serialredir.h"
 #endif
@@ -37,10 +39,33 @@ struct _ClientConn {
     gboolean disconnecting;
     ClientConnDisconnectReason reason;
     FlexvdiPort * guest_agent_port, * control_port;
+    // Automatic reconnection
+    gint reconnect_timeout;
+    gboolean was_connected;
+    gboolean reconnecting;
+    gint64 reconnect_deadline;
+    guint reconnect_delay;
+    guint reconnect_id;
+    // Channel bring-up, see channel_is_essential
+    gboolean bring_up_done;
+    guint bring_up_id;
+    GList * deferred_channels;
+    GList * deferred_tunnels;
+    gboolean first_mark;
+    CompressionMonitor * compression;
 };
 
+// Delay between reconnection attempts, doubled after each one, in ms
+#define RECONNECT_MIN_DELAY 500
+#define RECONNECT_MAX_DELAY 5000
+
+// Time after the main channel opens to bring up the deferred channels, in ms
+#define BRING_UP_DELAY 2000
+
 enum {
     CLIENT_CONN_DISCONNECTED = 0,
+    CLIENT_CONN_RECONNECTING,
+    CLIENT_CONN_RECONNECTED,
     CLIENT_CONN_LAST_SIGNAL
 };
 
@@ -51,6 +76,7 @@ G_DEFINE_TYPE(ClientConn, client_conn, G_TYPE_OBJECT);
 
 static void client_conn_dispose(GObject * obj);
 static void client_conn_finalize(GObject * obj);
+static void client_conn_reset_bring_up(ClientConn * conn);
 
 static void client_conn_class_init(ClientConnClass * class) {
     GObjectClass * object_class = G_OBJECT_CLASS(class);
@@ -68,6 +94,28 @@ static void client_conn_class_init(ClientConnClass * class) {
                      G_TYPE_NONE,
                      1,
                      G_TYPE_INT);
+
+    // Emited when the connection is lost and a reconnection starts
+    signals[CLIENT_CONN_RECONNECTING] =
+        g_signal_new("reconnecting",
+                     CLIENT_CONN_TYPE,
+                     G_SIGNAL_RUN_FIRST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__VOID,
+                     G_TYPE_NONE,
+                     0);
+
+    // Emited when the connection is restored
+    signals[CLIENT_CONN_RECONNECTED] =
+        g_signal_new("reconnected",
+                     CLIENT_CONN_TYPE,
+                     G_SIGNAL_RUN_FIRST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_marshal_VOID__VOID,
+                     G_TYPE_NONE,
+                     0);
 }
 
 
@@ -90,10 +138,17 @@ static void client_conn_init(ClientConn * conn) {
 
 static void client_conn_dispose(GObject * obj) {
     ClientConn * conn = CLIENT_CONN(obj);
+    if (conn->reconnect_id) {
+        g_source_remove(conn->reconnect_id);
+        conn->reconnect_id = 0;
+    }
+    client_conn_reset_bring_up(conn);
+    g_clear_object(&conn->compression);
     g_clear_object(&conn->session);
     g_clear_object(&conn->guest_agent_port);
     g_clear_object(&conn->control_port);
     g_list_free_full(conn->tunnels, (GDestroyNotify)ws_tunnel_unref);
+    conn->tunnels = NULL;
     G_OBJECT_CLASS(client_conn_parent_class)->dispose(obj);
 }
 
@@ -107,7 +162,28 @@ static void client_conn_finalize(GObject * obj) {
 }
 
 
-ClientConn * client_conn_new(ClientConf * conf, JsonObject * params) {
+/*
+ * The socket of a channel only reaches the local end of its WebSocket tunnel.
+ */
+static GSocket * get_link_socket(gpointer user_data, SpiceChannel * channel) {
+    ClientConn * conn = CLIENT_CONN(user_data);
+    GSocket * socket = NULL;
+    GList * tunnel;
+
+    if (!conn->use_ws) {
+        g_object_get(channel, "socket", &socket, NULL);
+        return socket;
+    }
+    for (tunnel = conn->tunnels; tunnel != NULL; tunnel = tunnel->next)
+        if (ws_tunnel_is_channel(WS_TUNNEL(tunnel->data), channel)) {
+            socket = ws_tunnel_get_socket(WS_TUNNEL(tunnel->data));
+            return socket ? g_object_ref(socket) : NULL;
+        }
+    return NULL;
+}
+
+
+ClientConn * client_conn_new(ClientConf * conf, ClientScheduler * scheduler, JsonObject * params) {
     ClientConn * conn = CLIENT_CONN(g_object_new(CLIENT_CONN_TYPE, NULL));
 
     g_object_set(conn->session,
@@ -129,16 +205,29 @@ ClientConn * client_conn_new(ClientConf * conf, JsonObject * params) {
                      NULL);
     }
     client_conf_set_session_options(conf, conn->session);
+    // The same password or token is used to reconnect, unless the manager forbids it
+    conn->reconnect_timeout = client_conf_get_reconnect_timeout(conf);
+    if (json_object_has_member(params, "allow_reconnect") &&
+        !json_object_get_boolean_member(params, "allow_reconnect"))
+        conn->reconnect_timeout = 0;
+    if (client_conf_get_adaptive_compression(conf))
+        conn->compression = compression_monitor_new(conn->session, scheduler,
+                                                    get_link_socket, conn);
 
     return conn;
 }
 
 
-ClientConn * client_conn_new_with_uri(ClientConf * conf, const char * uri) {
+ClientConn * client_conn_new_with_uri(ClientConf * conf, ClientScheduler * scheduler,
+                                      const char * uri) {
     ClientConn * conn = CLIENT_CONN(g_object_new(CLIENT_CONN_TYPE, NULL));
     conn->use_ws = FALSE;
     g_object_set(conn->session, "uri", uri, NULL);
     client_conf_set_session_options(conf, conn->session);
+    conn->reconnect_timeout = client_conf_get_reconnect_timeout(conf);
+    if (client_conf_get_adaptive_compression(conf))
+        conn->compression = compression_monitor_new(conn->session, scheduler,
+                                                    get_link_socket, conn);
 
     return conn;
 }
@@ -146,6 +235,9 @@ ClientConn * client_conn_new_with_uri(ClientConf * conf, const char * uri) {
 
 void client_conn_connect(ClientConn * conn) {
     conn->disconnecting = FALSE;
+    client_conn_reset_bring_up(conn);
+    conn->first_mark = FALSE;
+    client_timeline_mark("session connect");
     if (conn->use_ws)
         spice_session_open_fd(conn->session, -1);
     else
@@ -153,7 +245,21 @@ void client_conn_connect(ClientConn * conn) {
 }
 
 
+static void client_conn_finish_disconnection(ClientConn * conn);
+
 void client_conn_disconnect(ClientConn * conn, ClientConnDisconnectReason reason) {
+    if (conn->reconnecting) {
+        // Give up reconnecting
+        conn->reconnecting = FALSE;
+        conn->reason = reason;
+        if (conn->reconnect_id) {
+            // Waiting for the next attempt, there are no channels left
+            g_source_remove(conn->reconnect_id);
+            conn->reconnect_id = 0;
+            client_conn_finish_disconnection(conn);
+            return;
+        }
+    }
     if (conn->disconnecting)
         return;
     conn->disconnecting = TRUE;
@@ -164,19 +270,197 @@ void client_conn_disconnect(ClientConn * conn, ClientConnDisconnectReason reason
 }
 
 
+/*
+ * Whether the connection can be restored after it closed for this reason. Only
+ * connections that were established, and lost by an I/O error, are restored. Errors
+ * connecting again do not stop the reconnection until the deadline.
+ */
+static gboolean client_conn_can_reconnect(ClientConn * conn, ClientConnDisconnectReason reason) {
+    if (reason != CLIENT_CONN_DISCONNECT_IO_ERROR &&
+        !(conn->reconnecting && reason == CLIENT_CONN_DISCONNECT_CONN_ERROR))
+        return FALSE;
+    if (!conn->was_connected || conn->reconnect_timeout <= 0)
+        return FALSE;
+    return !conn->reconnect_deadline || g_get_monotonic_time() < conn->reconnect_deadline;
+}
+
+
+/*
+ * client_conn_lost
+ *
+ * A channel closed or failed. Reconnect if possible, or disconnect otherwise.
+ */
+static void client_conn_lost(ClientConn * conn, ClientConnDisconnectReason reason) {
+    // Channels closing for a reconnection also report errors
+    if (conn->reconnecting && conn->disconnecting)
+        return;
+
+    if (!client_conn_can_reconnect(conn, reason)) {
+        client_conn_disconnect(conn, reason);
+    } else if (!conn->disconnecting) {
+        if (!conn->reconnecting) {
+            g_warning("Connection lost, reconnecting");
+            conn->reconnecting = TRUE;
+            conn->reconnect_deadline = g_get_monotonic_time() +
+                (gint64)conn->reconnect_timeout * G_USEC_PER_SEC;
+            conn->reconnect_delay = RECONNECT_MIN_DELAY;
+            g_signal_emit(conn, signals[CLIENT_CONN_RECONNECTING], 0);
+        }
+        // Close the remaining channels, then connect again
+        conn->disconnecting = TRUE;
+        conn->reason = reason;
+        if (conn->use_ws)
+            soup_session_abort(conn->soup);
+        spice_session_disconnect(conn->session);
+    }
+}
+
+
+static gboolean client_conn_reconnect(gpointer user_data) {
+    ClientConn * conn = CLIENT_CONN(user_data);
+    conn->reconnect_id = 0;
+    g_debug("Reconnecting");
+    g_list_free_full(conn->tunnels, (GDestroyNotify)ws_tunnel_unref);
+    conn->tunnels = NULL;
+    conn->main = NULL;
+    client_conn_connect(conn);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * All the channels are closed. Schedule the next reconnection attempt, or finish
+ * the disconnection if the deadline passed.
+ */
+static void client_conn_schedule_reconnect(ClientConn * conn) {
+    gint64 now = g_get_monotonic_time();
+    if (now >= conn->reconnect_deadline) {
+        g_warning("Could not reconnect in %d seconds", conn->reconnect_timeout);
+        conn->reconnecting = FALSE;
+        client_conn_finish_disconnection(conn);
+        return;
+    }
+
+    // Half of the delay is random
+    guint delay = conn->reconnect_delay / 2 + g_random_int_range(0, conn->reconnect_delay / 2 + 1);
+    delay = MIN(delay, (conn->reconnect_deadline - now) / 1000);
+    conn->reconnect_delay = MIN(conn->reconnect_delay * 2, RECONNECT_MAX_DELAY);
+    g_debug("Next reconnection attempt in %u ms", delay);
+    conn->reconnect_id = g_timeout_add(delay, client_conn_reconnect, conn);
+}
+
+
+/*
+ * Emit the disconnected signal and release the reference held while connected.
+ */
+static void client_conn_finish_disconnection(ClientConn * conn) {
+    g_signal_emit(conn, signals[CLIENT_CONN_DISCONNECTED], 0, conn->reason);
+    g_object_unref(conn);
+}
+
+
 SpiceSession * client_conn_get_session(ClientConn * conn) {
     return conn->session;
 }
 
 
 static void open_ws_tunnel(SpiceChannel * channel, int with_tls, gpointer user_data);
+static void display_mark(SpiceChannel * channel, gint mark, ClientConn * conn);
+static void timeline_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                   gpointer user_data);
 static void port_channel(SpiceChannel * channel, GParamSpec * pspec, ClientConn * conn);
 static void main_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
                                ClientConn * conn);
+static void display_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                  ClientConn * conn);
+
+/*
+ * channel_is_essential
+ *
+ * Whether the channel is needed to show the desktop and interact with it. The other
+ * channels are brought up after the first frame, or BRING_UP_DELAY ms after the main
+ * channel opens, so that they do not compete for bandwidth with the first ones.
+ */
+static gboolean channel_is_essential(SpiceChannel * channel) {
+    return SPICE_IS_MAIN_CHANNEL(channel) || SPICE_IS_DISPLAY_CHANNEL(channel) ||
+           SPICE_IS_INPUTS_CHANNEL(channel) || SPICE_IS_CURSOR_CHANNEL(channel);
+}
+
+
+/*
+ * Finish the connection process of a non-essential channel: connect port and
+ * webdav channels, and set up the audio channels.
+ */
+static void bring_up_channel(ClientConn * conn, SpiceChannel * channel) {
+    if (SPICE_IS_PLAYBACK_CHANNEL(channel)) {
+        conn->audio = spice_audio_get(conn->session, NULL);
+    }
+
+    if (SPICE_IS_WEBDAV_CHANNEL(channel)) {
+        g_autofree gchar * shared_dir = NULL;
+        g_object_get(conn->session, "shared-dir", &shared_dir, NULL);
+        if (shared_dir != NULL)
+            spice_channel_connect(channel);
+    } else if (SPICE_IS_PORT_CHANNEL(channel)) {
+        g_signal_connect(channel, "notify::port-name",
+                         G_CALLBACK(port_channel), conn);
+        spice_channel_connect(channel);
+    }
+}
+
 
 /*
- * New channel handler. Finishes the connection process of each channel.
- * Besides, saves a reference to the main channel and sets up the audio channel.
+ * Bring up the channels that were deferred, once the desktop is on screen.
+ */
+static void client_conn_bring_up_deferred(ClientConn * conn) {
+    GList * it;
+    if (conn->bring_up_done) return;
+    conn->bring_up_done = TRUE;
+    if (conn->bring_up_id) {
+        g_source_remove(conn->bring_up_id);
+        conn->bring_up_id = 0;
+    }
+
+    g_debug("Bringing up %u deferred channels and %u tunnels",
+            g_list_length(conn->deferred_channels), g_list_length(conn->deferred_tunnels));
+    GList * channels = conn->deferred_channels, * tunnels = conn->deferred_tunnels;
+    conn->deferred_channels = conn->deferred_tunnels = NULL;
+    for (it = channels; it; it = it->next)
+        bring_up_channel(conn, SPICE_CHANNEL(it->data));
+    for (it = tunnels; it; it = it->next)
+        open_ws_tunnel(SPICE_CHANNEL(it->data), 0, conn);
+    g_list_free_full(channels, g_object_unref);
+    g_list_free_full(tunnels, g_object_unref);
+}
+
+
+static gboolean bring_up_timeout(gpointer user_data) {
+    ClientConn * conn = CLIENT_CONN(user_data);
+    conn->bring_up_id = 0;
+    client_conn_bring_up_deferred(conn);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * Forget the deferred channels, before a new connection starts or when the
+ * connection is destroyed.
+ */
+static void client_conn_reset_bring_up(ClientConn * conn) {
+    conn->bring_up_done = FALSE;
+    if (conn->bring_up_id) {
+        g_source_remove(conn->bring_up_id);
+        conn->bring_up_id = 0;
+    }
+    g_list_free_full(conn->deferred_channels, g_object_unref);
+    g_list_free_full(conn->deferred_tunnels, g_object_unref);
+    conn->deferred_channels = conn->deferred_tunnels = NULL;
+}
+
+
+/*
+ * New channel handler. Finishes the connection process of each channel, deferring
+ * the non-essential ones. Besides, saves a reference to the main channel.
  */
 static void channel_new(SpiceSession * s, SpiceChannel * channel, gpointer data) {
     ClientConn * conn = CLIENT_CONN(data);
@@ -188,6 +472,8 @@ static void channel_new(SpiceSession * s, SpiceChannel * channel, gpointer data)
 
     if (conn->use_ws)
         g_signal_connect(channel, "open-fd", G_CALLBACK(open_ws_tunnel), conn);
+    g_signal_connect(channel, "channel-event",
+                     G_CALLBACK(timeline_channel_event), conn);
 
     if (SPICE_IS_MAIN_CHANNEL(channel)) {
         conn->main = SPICE_MAIN_CHANNEL(channel);
@@ -196,23 +482,44 @@ static void channel_new(SpiceSession * s, SpiceChannel * channel, gpointer data)
     }
 
     if (SPICE_IS_DISPLAY_CHANNEL(channel)) {
+        g_signal_connect(channel, "channel-event",
+                         G_CALLBACK(display_channel_event), conn);
+        g_signal_connect(channel, "display-mark",
+                         G_CALLBACK(display_mark), conn);
+        if (conn->compression)
+            compression_monitor_add_channel(conn->compression, channel);
         spice_channel_connect(channel);
     }
 
-    if (SPICE_IS_PLAYBACK_CHANNEL(channel)) {
-        conn->audio = spice_audio_get(s, NULL);
+    if (channel_is_essential(channel) || conn->bring_up_done) {
+        bring_up_channel(conn, channel);
+    } else {
+        g_debug("Deferring channel %d:%d", type, id);
+        conn->deferred_channels = g_list_append(conn->deferred_channels, g_object_ref(channel));
     }
+}
 
-    if (SPICE_IS_WEBDAV_CHANNEL(channel)) {
-        gchar * shared_dir = NULL;
-        g_object_get(s, "shared-dir", &shared_dir, NULL);
-        if (shared_dir != NULL)
-            spice_channel_connect(channel);
-    } else if (SPICE_IS_PORT_CHANNEL(channel)) {
-        g_signal_connect(channel, "notify::port-name",
-                         G_CALLBACK(port_channel), conn);
-        spice_channel_connect(channel);
+
+/*
+ * Record when each channel opens in the connection timeline.
+ */
+static void timeline_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                   gpointer user_data) {
+    if (event == SPICE_CHANNEL_OPENED) {
+        int id, type;
+        g_object_get(channel, "channel-id", &id, "channel-type", &type, NULL);
+        client_timeline_mark("%s channel %d opened", spice_channel_type_to_string(type), id);
+    }
+}
+
+
+static void display_mark(SpiceChannel * channel, gint mark, ClientConn * conn) {
+    if (mark && !conn->first_mark) {
+        conn->first_mark = TRUE;
+        client_timeline_mark("first display mark");
     }
+    if (mark)
+        client_conn_bring_up_deferred(conn);
 }
 
 
@@ -227,10 +534,25 @@ static void channel_destroy(SpiceSession * s, SpiceChannel * channel, gpointer d
     g_debug("Destroyed Spice channel (%d:%d)", type, id);
     conn->channels--;
 
+    GList * link = g_list_find(conn->deferred_channels, channel);
+    if (link) {
+        conn->deferred_channels = g_list_delete_link(conn->deferred_channels, link);
+        g_object_unref(channel);
+    }
+    link = g_list_find(conn->deferred_tunnels, channel);
+    if (link) {
+        conn->deferred_tunnels = g_list_delete_link(conn->deferred_tunnels, link);
+        g_object_unref(channel);
+    }
+    if (conn->compression && SPICE_IS_DISPLAY_CHANNEL(channel))
+        compression_monitor_remove_channel(conn->compression, channel);
+
     if (conn->channels <= 0) {
         g_debug("No more channels left");
-        g_signal_emit(conn, signals[CLIENT_CONN_DISCONNECTED], 0, conn->reason);
-        g_object_unref(conn);
+        if (conn->reconnecting)
+            client_conn_schedule_reconnect(conn);
+        else
+            client_conn_finish_disconnection(conn);
     }
 }
 
@@ -250,6 +572,15 @@ static void open_ws_tunnel(SpiceChannel * channel, int with_tls, gpointer user_d
     int id, type;
     g_object_get(channel, "channel-id", &id, "channel-type", &type, NULL);
 
+    // Each tunnel makes its own WebSocket handshake, let the essential ones go first
+    if (!channel_is_essential(channel) && !conn->bring_up_done) {
+        if (!g_list_find(conn->deferred_tunnels, channel)) {
+            g_debug("Deferring the WS tunnel for channel %d:%d", type, id);
+            conn->deferred_tunnels = g_list_append(conn->deferred_tunnels, g_object_ref(channel));
+        }
+        return;
+    }
+
     GList * tunnels;
     for (tunnels = conn->tunnels; tunnels; tunnels = tunnels->next)
         if (ws_tunnel_is_channel((WsTunnel *)tunnels->data, channel)) {
@@ -263,7 +594,7 @@ static void open_ws_tunnel(SpiceChannel * channel, int with_tls, gpointer user_d
     WsTunnel * tunnel = ws_tunnel_new(channel, conn->soup, uri);
     if (!tunnel) {
         g_critical("Failed to create a WS tunnel");
-        client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
     } else {
         conn->tunnels = g_list_append(conn->tunnels, tunnel);
         g_signal_connect(tunnel, "error", G_CALLBACK(tunnel_error), conn);
@@ -275,13 +606,13 @@ static void open_ws_tunnel(SpiceChannel * channel, int with_tls, gpointer user_d
 static void tunnel_error(WsTunnel * tunnel, GError * error, gpointer user_data) {
     ClientConn * conn = CLIENT_CONN(user_data);
     g_error_free(error);
-    client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
+    client_conn_lost(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
 }
 
 
 static void tunnel_eof(WsTunnel * tunnel, gpointer user_data) {
     ClientConn * conn = CLIENT_CONN(user_data);
-    client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
+    client_conn_lost(conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
 }
 
 
@@ -313,16 +644,25 @@ static void main_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
     switch (event) {
     case SPICE_CHANNEL_OPENED:
         g_debug("main channel: opened");
+        conn->was_connected = TRUE;
+        if (!conn->bring_up_done && !conn->bring_up_id)
+            conn->bring_up_id = g_timeout_add(BRING_UP_DELAY, bring_up_timeout, conn);
+        if (conn->reconnecting) {
+            g_message("Connection restored");
+            conn->reconnecting = FALSE;
+            conn->reconnect_deadline = 0;
+            g_signal_emit(conn, signals[CLIENT_CONN_RECONNECTED], 0);
+        }
         break;
     case SPICE_CHANNEL_SWITCHING:
         g_debug("main channel: switching host");
         break;
     case SPICE_CHANNEL_CLOSED:
         g_debug("main channel: closed");
-        client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
         break;
     case SPICE_CHANNEL_ERROR_IO:
-        client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
         break;
     case SPICE_CHANNEL_ERROR_TLS:
     case SPICE_CHANNEL_ERROR_LINK:
@@ -332,11 +672,11 @@ static void main_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
         if (error) {
             g_debug("channel error: %s", error->message);
         }
-        client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_CONN_ERROR);
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_CONN_ERROR);
         break;
     case SPICE_CHANNEL_ERROR_AUTH:
         g_warning("main channel: auth failure (wrong password?)");
-        client_conn_disconnect(conn, CLIENT_CONN_DISCONNECT_AUTH_ERROR);
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_AUTH_ERROR);
         break;
     default:
         g_warning("unknown main channel event: %u", event);
@@ -345,11 +685,49 @@ static void main_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
 }
 
 
+/*
+ * Display channel event handler. Its I/O errors may arrive before those of the
+ * main channel.
+ */
+static void display_channel_event(SpiceChannel * channel, SpiceChannelEvent event,
+                                  ClientConn * conn) {
+    switch (event) {
+    case SPICE_CHANNEL_CLOSED:
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
+        break;
+    case SPICE_CHANNEL_ERROR_IO:
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_IO_ERROR);
+        break;
+    case SPICE_CHANNEL_ERROR_TLS:
+    case SPICE_CHANNEL_ERROR_LINK:
+    case SPICE_CHANNEL_ERROR_CONNECT:
+    case SPICE_CHANNEL_ERROR_AUTH:
+        client_conn_lost(conn, CLIENT_CONN_DISCONNECT_CONN_ERROR);
+        break;
+    default:
+        break;
+    }
+}
+
+
 SpiceMainChannel * client_conn_get_main_channel(ClientConn * conn) {
     return conn->main;
 }
 
 
+void client_conn_get_tunnel_stats(ClientConn * conn, gint64 * rtt, gsize * queued) {
+    GList * tunnel;
+    *rtt = -1;
+    *queued = 0;
+    for (tunnel = conn->tunnels; tunnel != NULL; tunnel = tunnel->next) {
+        gint64 tunnel_rtt = ws_tunnel_get_rtt(WS_TUNNEL(tunnel->data));
+        if (tunnel_rtt >= 0 && (*rtt < 0 || tunnel_rtt < *rtt))
+            *rtt = tunnel_rtt;
+        *queued += ws_tunnel_get_queued_bytes(WS_TUNNEL(tunnel->data));
+    }
+}
+
+
 ClientConnDisconnectReason client_conn_get_reason(ClientConn * conn) {
     return conn->reason;
 }
@@ -26,6 +26,7 @@
 
 #include "configuration.h"
 #include "flexvdi-port.h"
+#include "client-scheduler.h"
 
 
 typedef enum {
@@ -42,7 +43,9 @@ typedef enum {
  *
  * Client connection with the Spice protocol. It controls the
  * life-cycle of a Spice connection, the Spice session and
- * its channels.
+ * its channels. When an established connection is lost, it
+ * is restored with the same parameters for a while, emitting
+ * the "reconnecting" and "reconnected" signals.
  */
 #define CLIENT_CONN_TYPE (client_conn_get_type())
 G_DECLARE_FINAL_TYPE(ClientConn, client_conn, CLIENT, CONN, GObject)
@@ -51,9 +54,10 @@ G_DECLARE_FINAL_TYPE(ClientConn, client_conn, CLIENT, CONN, GObject)
  * client_conn_new
  *
  * Create a new connection with the current configuration parameters and
- * the parameters received from the flexVDI Manager.
+ * the parameters received from the flexVDI Manager. Periodic work runs on
+ * the scheduler, or on GLib timeouts if it is NULL.
  */
-ClientConn * client_conn_new(ClientConf * conf, JsonObject * params);
+ClientConn * client_conn_new(ClientConf * conf, ClientScheduler * scheduler, JsonObject * params);
 
 /*
  * client_conn_new_with_uri
@@ -61,7 +65,8 @@ ClientConn * client_conn_new(ClientConf * conf, JsonObject * params);
  * Create a new connection with the current configuration and the uri
  * passed with the command line.
  */
-ClientConn * client_conn_new_with_uri(ClientConf * conf, const char * uri);
+ClientConn * client_conn_new_with_uri(ClientConf * conf, ClientScheduler * scheduler,
+                                      const char * uri);
 
 /*
  * client_conn_connect
@@ -95,6 +100,16 @@ SpiceSession * client_conn_get_session(ClientConn * conn);
  */
 SpiceMainChannel * client_conn_get_main_channel(ClientConn * conn);
 
+/*
+ * client_conn_get_tunnel_stats
+ *
+ * Get the smallest WebSocket handshake round-trip time of the tunnels, in
+ * microseconds or -1 if it is not known, and the bytes received and not consumed
+ * by the channels yet. Without WebSocket, the RTT is always unknown and no bytes
+ * are queued. These are diagnostics, not a measure of link saturation.
+ */
+void client_conn_get_tunnel_stats(ClientConn * conn, gint64 * rtt, gsize * queued);
+
 /*
  * client_conn_get_reason
  *
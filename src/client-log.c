@@ -19,6 +19,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <spice-client.h>
 #ifdef ANDROID
 #include <android/log.h>
@@ -26,41 +34,417 @@
 #include "client-log.h"
 
 
-typedef struct _LevelForDomain {
-    gchar * domain;
-    GLogLevelFlags level;
-} LevelForDomain;
-
-
-static GList * level_for_domains = NULL;
+/*
+ * Per-domain levels are kept in a hash table. The least and most verbose levels
+ * are also kept, so that most messages are accepted or discarded without looking
+ * up their domain.
+ */
+static GHashTable * level_for_domains = NULL;
+static GRWLock level_lock;
 static GLogLevelFlags default_level = G_LOG_LEVEL_MESSAGE;
+static gint min_level = G_LOG_LEVEL_MESSAGE;
+static gint max_level = G_LOG_LEVEL_MESSAGE;
 static GLogLevelFlags fatal_level = G_LOG_LEVEL_ERROR;
 static FILE * old_stdout = NULL;
+static gboolean json_format = FALSE;
 
 
-int client_log_get_level_for_domain(const gchar * domain) {
-    GList * i;
-    for (i = level_for_domains; i; i = i->next) {
-        LevelForDomain * lfd = (LevelForDomain *)i->data;
-        if (g_str_equal(lfd->domain, domain)) return lfd->level;
+#ifndef ANDROID
+/*
+ * Log records are formatted by the thread that logs them, and written to the log
+ * file by a writer thread, in batches. They are passed through a bounded
+ * multi-producer ring buffer (D. Vyukov's algorithm) so that logging threads
+ * never take a lock. When the ring is full, debug records are dropped and counted,
+ * while the rest wait for the writer to make room. Errors and critical messages
+ * are written before the logging call returns.
+ */
+#define LOG_RING_SIZE 4096
+#define LOG_BATCH_SIZE 256
+
+typedef struct _LogSlot {
+    gint sequence;
+    gint64 time;
+    gchar * text;
+} LogSlot;
+
+/*
+ * The log file is rotated when it grows beyond max_log_size bytes, keeping up to
+ * log_archives older files compressed with gzip. The writer only renames the file;
+ * a single archiver thread compresses the rotated files in order, so that the
+ * writer, and the threads waiting for it, do not wait for gzip.
+ */
+#define DEFAULT_MAX_LOG_SIZE (10 * 1024 * 1024)
+#define DEFAULT_LOG_ARCHIVES 3
+
+static gchar * log_path;
+static gint64 log_size;
+static gint64 max_log_size = DEFAULT_MAX_LOG_SIZE;
+static int log_archives = DEFAULT_LOG_ARCHIVES;
+static GThreadPool * archiver;
+static guint rotations;
+static gint pending_archives;
+static GMutex archive_mutex;
+static GCond archive_cond;
+
+static LogSlot log_ring[LOG_RING_SIZE];
+static gint enqueue_pos;
+static guint dequeue_pos;
+static guint written_pos;
+static gint dropped_records;
+static gint writer_sleeping;
+static GThread * writer_thread;
+static GMutex writer_mutex;
+static GCond writer_cond, flushed_cond;
+
+
+static gboolean log_ring_push(gint64 time, gchar * text, guint * ticket) {
+    guint pos = g_atomic_int_get(&enqueue_pos);
+    for (;;) {
+        LogSlot * slot = &log_ring[pos % LOG_RING_SIZE];
+        gint diff = (gint)((guint)g_atomic_int_get(&slot->sequence) - pos);
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&enqueue_pos, pos, pos + 1)) break;
+            pos = g_atomic_int_get(&enqueue_pos);
+        } else if (diff < 0) {
+            return FALSE;
+        } else {
+            pos = g_atomic_int_get(&enqueue_pos);
+        }
+    }
+    LogSlot * slot = &log_ring[pos % LOG_RING_SIZE];
+    slot->time = time;
+    slot->text = text;
+    g_atomic_int_set(&slot->sequence, pos + 1);
+    *ticket = pos;
+    return TRUE;
+}
+
+
+// Only called from the writer thread
+static gboolean log_ring_pop(gint64 * time, gchar ** text) {
+    LogSlot * slot = &log_ring[dequeue_pos % LOG_RING_SIZE];
+    if ((gint)((guint)g_atomic_int_get(&slot->sequence) - (dequeue_pos + 1)) < 0)
+        return FALSE;
+    *time = slot->time;
+    *text = slot->text;
+    g_atomic_int_set(&slot->sequence, dequeue_pos + LOG_RING_SIZE);
+    ++dequeue_pos;
+    return TRUE;
+}
+
+
+// Only called from the writer thread
+static gboolean log_ring_pending() {
+    LogSlot * slot = &log_ring[dequeue_pos % LOG_RING_SIZE];
+    return (gint)((guint)g_atomic_int_get(&slot->sequence) - (dequeue_pos + 1)) >= 0;
+}
+
+
+static void wake_writer() {
+    g_mutex_lock(&writer_mutex);
+    g_cond_signal(&writer_cond);
+    g_mutex_unlock(&writer_mutex);
+}
+
+
+static void append_timestamp(GString * batch, gint64 time) {
+    // JSON records carry their own timestamps
+    if (json_format) return;
+    // Records come in order, so the date is only formatted once per second
+    static gint64 last_second = -1;
+    static gchar date[32];
+    gint64 second = time / G_USEC_PER_SEC;
+    if (second != last_second) {
+        g_autoptr(GDateTime) dt = g_date_time_new_from_unix_local(second);
+        g_autofree gchar * dt_str = g_date_time_format(dt, "%Y/%m/%d %H:%M:%S");
+        g_strlcpy(date, dt_str, sizeof(date));
+        last_second = second;
+    }
+    g_string_append_printf(batch, "%s.%03d: ", date, (int)(time % G_USEC_PER_SEC / 1000));
+}
+
+
+static void compress_file(const gchar * path, const gchar * archive) {
+    g_autoptr(GFile) in_file = g_file_new_for_path(path);
+    g_autoptr(GFile) out_file = g_file_new_for_path(archive);
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFileInputStream) in = g_file_read(in_file, NULL, &error);
+    if (in) {
+        g_autoptr(GFileOutputStream) out =
+            g_file_replace(out_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+        if (out) {
+            g_autoptr(GZlibCompressor) compressor =
+                g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+            g_autoptr(GOutputStream) gz =
+                g_converter_output_stream_new(G_OUTPUT_STREAM(out), G_CONVERTER(compressor));
+            g_output_stream_splice(gz, G_INPUT_STREAM(in),
+                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                NULL, &error);
+        }
     }
-    return default_level;
+    if (error)
+        g_warning("Could not archive log file %s: %s", path, error->message);
 }
 
 
-static void update_level_for_domain(const gchar * domain, GLogLevelFlags level) {
-    GList * i;
-    for (i = level_for_domains; i; i = i->next) {
-        LevelForDomain * lfd = (LevelForDomain *)i->data;
-        if (g_str_equal(lfd->domain, domain)) {
-            lfd->level = level;
+/*
+ * Archive a rotated log file, in the archiver thread: log.N.gz becomes
+ * log.N+1.gz and the rotated file is compressed to log.1.gz.
+ */
+static void archive_log(gpointer data, gpointer user_data) {
+    g_autofree gchar * rotated = data;
+    g_autofree gchar * archive = g_strdup_printf("%s.1.gz", log_path);
+    int i;
+    for (i = log_archives - 1; i > 0; --i) {
+        g_autofree gchar * from = g_strdup_printf("%s.%d.gz", log_path, i);
+        g_autofree gchar * to = g_strdup_printf("%s.%d.gz", log_path, i + 1);
+        g_remove(to);
+        g_rename(from, to);
+    }
+    compress_file(rotated, archive);
+    g_remove(rotated);
+    g_mutex_lock(&archive_mutex);
+    --pending_archives;
+    g_cond_broadcast(&archive_cond);
+    g_mutex_unlock(&archive_mutex);
+}
+
+
+/*
+ * Rotate the log file: the current contents are moved aside for the archiver,
+ * and the log file starts empty.
+ */
+static void rotate_log() {
+    fflush(stderr);
+    fflush(stdout);
+    if (log_archives > 0) {
+        gchar * rotated = g_strdup_printf("%s.%u.rotated", log_path, ++rotations);
+#ifdef _WIN32
+        // Open files cannot be renamed
+        freopen("NUL", "w", stderr);
+        freopen("NUL", "w", stdout);
+#endif
+        if (g_rename(log_path, rotated) == 0) {
+            if (!archiver)
+                archiver = g_thread_pool_new(archive_log, NULL, 1, FALSE, NULL);
+            g_mutex_lock(&archive_mutex);
+            ++pending_archives;
+            g_mutex_unlock(&archive_mutex);
+            g_thread_pool_push(archiver, rotated, NULL);
+        } else {
+            g_free(rotated);
+        }
+    }
+    freopen(log_path, "w", stderr);
+    setvbuf(stderr, NULL, _IONBF, 2);
+    freopen(log_path, "a", stdout);
+    log_size = 0;
+}
+
+
+static gchar * format_json_record(const gchar * domain, const gchar * level,
+                                  const gchar * message);
+
+
+/*
+ * Write all the queued records, in batches of one write each.
+ */
+static void write_pending_records(GString * batch) {
+    gint64 time;
+    gchar * text;
+    int count;
+    do {
+        g_string_truncate(batch, 0);
+        for (count = 0; count < LOG_BATCH_SIZE && log_ring_pop(&time, &text); ++count) {
+            append_timestamp(batch, time);
+            g_string_append(batch, text);
+            g_free(text);
+        }
+        gint dropped = g_atomic_int_and(&dropped_records, 0);
+        if (dropped) {
+            g_autofree gchar * message =
+                g_strdup_printf("%d debug messages dropped", dropped);
+            if (json_format) {
+                g_autofree gchar * record = format_json_record("flexvdi", "WARNING", message);
+                g_string_append(batch, record);
+            } else {
+                append_timestamp(batch, g_get_real_time());
+                g_string_append_printf(batch, "flexvdi-WARNING: %s\n", message);
+            }
+        }
+        if (batch->len) {
+            fwrite(batch->str, 1, batch->len, stderr);
+            fflush(stderr);
+            log_size += batch->len;
+            if (log_path && max_log_size > 0 && log_size >= max_log_size)
+                rotate_log();
+        }
+        g_mutex_lock(&writer_mutex);
+        written_pos = dequeue_pos;
+        g_cond_broadcast(&flushed_cond);
+        g_mutex_unlock(&writer_mutex);
+    } while (count == LOG_BATCH_SIZE);
+}
+
+
+static gpointer log_writer(gpointer user_data) {
+    g_autoptr(GString) batch = g_string_sized_new(64 * 1024);
+    for (;;) {
+        write_pending_records(batch);
+        g_mutex_lock(&writer_mutex);
+        g_atomic_int_set(&writer_sleeping, TRUE);
+        // Producers check writer_sleeping after pushing a record, and the writer checks
+        // the ring after setting it, so at least one of them sees the other. Producers
+        // signal with the mutex held, so the signal cannot come before the wait.
+        while (!log_ring_pending())
+            g_cond_wait(&writer_cond, &writer_mutex);
+        g_atomic_int_set(&writer_sleeping, FALSE);
+        g_mutex_unlock(&writer_mutex);
+    }
+    return NULL;
+}
+
+
+/*
+ * Wait until the writer has written the record with this ticket.
+ */
+static void wait_for_record(guint ticket) {
+    g_mutex_lock(&writer_mutex);
+    while ((gint)(written_pos - ticket) <= 0) {
+        g_cond_signal(&writer_cond);
+        g_cond_wait(&flushed_cond, &writer_mutex);
+    }
+    g_mutex_unlock(&writer_mutex);
+}
+
+
+static void queue_record(GLogLevelFlags log_level, gchar * text) {
+    gint64 time = g_get_real_time();
+    guint ticket;
+
+    if (writer_thread == NULL || g_thread_self() == writer_thread) {
+        // No writer yet, or a message from the writer itself
+        g_autoptr(GString) line = g_string_new(NULL);
+        append_timestamp(line, time);
+        g_string_append(line, text);
+        fputs(line->str, stderr);
+        g_free(text);
+        return;
+    }
+
+    while (!log_ring_push(time, text, &ticket)) {
+        if (log_level == G_LOG_LEVEL_DEBUG) {
+            g_atomic_int_inc(&dropped_records);
+            g_free(text);
             return;
         }
+        wake_writer();
+        g_thread_yield();
+    }
+
+    if (log_level <= G_LOG_LEVEL_CRITICAL)
+        wait_for_record(ticket);
+    else if (g_atomic_int_get(&writer_sleeping))
+        wake_writer();
+}
+
+
+static guint64 current_thread_id() {
+#ifdef _WIN32
+    return GetCurrentThreadId();
+#elif defined(__linux__)
+    return syscall(SYS_gettid);
+#else
+    return (guint64)(gsize)g_thread_self();
+#endif
+}
+
+
+static void append_json_string(GString * line, const gchar * str) {
+    const gchar * c;
+    g_string_append_c(line, '"');
+    for (c = str ? str : ""; *c; ++c) {
+        switch (*c) {
+            case '"': g_string_append(line, "\\\""); break;
+            case '\\': g_string_append(line, "\\\\"); break;
+            case '\n': g_string_append(line, "\\n"); break;
+            case '\t': g_string_append(line, "\\t"); break;
+            default:
+                if ((guchar)*c < 0x20)
+                    g_string_append_printf(line, "\\u%04x", (guchar)*c);
+                else
+                    g_string_append_c(line, *c);
+        }
     }
-    LevelForDomain * lfd = g_new0(LevelForDomain, 1);
-    lfd->domain = g_strdup(domain);
-    lfd->level = level;
-    level_for_domains = g_list_prepend(level_for_domains, lfd);
+    g_string_append_c(line, '"');
+}
+
+
+/*
+ * Format a record as a JSON line, with wall clock and monotonic timestamps in
+ * microseconds and the id of the logging thread.
+ */
+static gchar * format_json_record(const gchar * domain, const gchar * level,
+                                  const gchar * message) {
+    GString * line = g_string_sized_new(128);
+    g_string_append_printf(line,
+        "{\"time\":%" G_GINT64_FORMAT ",\"mono\":%" G_GINT64_FORMAT
+        ",\"thread\":%" G_GUINT64_FORMAT ",\"domain\":",
+        g_get_real_time(), g_get_monotonic_time(), current_thread_id());
+    append_json_string(line, domain);
+    g_string_append(line, ",\"level\":");
+    append_json_string(line, level);
+    g_string_append(line, ",\"message\":");
+    append_json_string(line, message);
+    g_string_append(line, "}\n");
+    return g_string_free(line, FALSE);
+}
+
+
+static void start_log_writer() {
+    int i;
+    for (i = 0; i < LOG_RING_SIZE; ++i)
+        log_ring[i].sequence = i;
+    writer_thread = g_thread_new("log-writer", log_writer, NULL);
+    atexit(client_log_flush);
+}
+#endif
+
+
+void client_log_flush() {
+#ifndef ANDROID
+    if (writer_thread != NULL && g_thread_self() != writer_thread)
+        wait_for_record(g_atomic_int_get(&enqueue_pos) - 1);
+    g_mutex_lock(&archive_mutex);
+    while (pending_archives > 0)
+        g_cond_wait(&archive_cond, &archive_mutex);
+    g_mutex_unlock(&archive_mutex);
+#endif
+}
+
+
+static GLogLevelFlags lookup_level(const gchar * domain) {
+    GLogLevelFlags level;
+    gpointer value;
+    g_rw_lock_reader_lock(&level_lock);
+    level = default_level;
+    if (domain && level_for_domains &&
+        g_hash_table_lookup_extended(level_for_domains, domain, NULL, &value))
+        level = GPOINTER_TO_INT(value);
+    g_rw_lock_reader_unlock(&level_lock);
+    return level;
+}
+
+
+int client_log_get_level_for_domain(const gchar * domain) {
+    return lookup_level(domain);
+}
+
+
+gboolean client_log_is_enabled(const gchar * domain, GLogLevelFlags level) {
+    if (level > g_atomic_int_get(&max_level)) return FALSE;
+    if (level <= g_atomic_int_get(&min_level)) return TRUE;
+    return level <= lookup_level(domain);
 }
 
 
@@ -71,17 +455,8 @@ static GLogWriterOutput log_to_file(GLogLevelFlags log_level, const GLogField *
     gboolean fatal = log_level & G_LOG_FLAG_FATAL;
     log_level &= G_LOG_LEVEL_MASK;
 
-    GLogLevelFlags max_level = default_level;
-    if (level_for_domains != NULL) {
-        for (i = 0; i < n_fields; ++i) {
-            if (g_str_equal(fields[i].key, "GLIB_DOMAIN")) {
-                log_domain = (const gchar *)fields[i].value;
-                max_level = client_log_get_level_for_domain(log_domain);
-                break;
-            }
-        }
-    }
-    if (log_level > max_level) return G_LOG_WRITER_HANDLED;
+    // Discard the message before even looking at its fields, if possible
+    if (log_level > g_atomic_int_get(&max_level)) return G_LOG_WRITER_HANDLED;
 
     for (i = 0; (log_domain == NULL || message == NULL) && i < n_fields; ++i) {
         if (g_str_equal(fields[i].key, "GLIB_DOMAIN")) {
@@ -90,6 +465,7 @@ static GLogWriterOutput log_to_file(GLogLevelFlags log_level, const GLogField *
             message = (const gchar *)fields[i].value;
         }
     }
+    if (!client_log_is_enabled(log_domain, log_level)) return G_LOG_WRITER_HANDLED;
 
     switch (log_level) {
         case G_LOG_LEVEL_ERROR: log_level_str = "ERROR"; break;
@@ -112,13 +488,16 @@ static GLogWriterOutput log_to_file(GLogLevelFlags log_level, const GLogField *
     }
     __android_log_print(android_log_level, log_domain, "%s", message);
 #else
-    g_autoptr(GDateTime) now = g_date_time_new_now_local();
-    g_autofree gchar * now_str = g_date_time_format(now, "%Y/%m/%d %H:%M:%S");
-    fprintf(stderr, "%s.%03d: %s-%s: %s\n", now_str, g_date_time_get_microsecond(now)/1000,
-            log_domain, log_level_str, message);
+    if (json_format)
+        queue_record(log_level, format_json_record(log_domain, log_level_str, message));
+    else
+        queue_record(log_level, g_strdup_printf("%s-%s: %s\n", log_domain, log_level_str, message));
 #endif
 
-    if (fatal || log_level <= fatal_level) G_BREAKPOINT();
+    if (fatal || log_level <= fatal_level) {
+        client_log_flush();
+        G_BREAKPOINT();
+    }
 
     return G_LOG_WRITER_HANDLED;
 }
@@ -148,8 +527,20 @@ void client_log_setup() {
         }
         freopen(file_path, "a", stderr);
         freopen(file_path, "a", stdout);
+
+        GStatBuf st;
+        log_size = g_stat(file_path, &st) == 0 ? st.st_size : 0;
+        log_path = g_steal_pointer(&file_path);
+        const gchar * max_size_str = g_getenv("FLEXVDI_LOG_MAX_SIZE");
+        if (max_size_str)
+            max_log_size = g_ascii_strtoll(max_size_str, NULL, 10) * 1024;
+        const gchar * archives_str = g_getenv("FLEXVDI_LOG_ARCHIVES");
+        if (archives_str)
+            log_archives = MAX(0, (int)g_ascii_strtoll(archives_str, NULL, 10));
     }
     setvbuf(stderr, NULL, _IONBF, 2);
+    json_format = !g_strcmp0(g_getenv("FLEXVDI_LOG_FORMAT"), "json");
+    start_log_writer();
 #endif
 
     g_log_set_writer_func(log_to_file, NULL, NULL);
@@ -168,9 +559,10 @@ void print_to_stdout(const gchar * string) {
 
 
 void client_log_set_log_levels(const gchar * verbose_str) {
-    g_list_free_full(level_for_domains, g_free);
-    level_for_domains = NULL;
-    default_level = G_LOG_LEVEL_MESSAGE;
+    GHashTable * domains = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GLogLevelFlags all_level = G_LOG_LEVEL_MESSAGE, least, most;
+    GHashTableIter it;
+    gpointer value;
 
     gchar ** levels = g_strsplit(verbose_str, ",", 0), ** level;
     for (level = levels; *level; ++level) {
@@ -178,14 +570,14 @@ void client_log_set_log_levels(const gchar * verbose_str) {
 
         gchar ** terms = g_strsplit(*level, ":", 0);
         if (*(terms + 1) == NULL) {
-            map_level(strtol(*terms, NULL, 10), &default_level);
+            map_level(strtol(*terms, NULL, 10), &all_level);
         } else {
             GLogLevelFlags glevel;
             if (map_level(strtol(*(terms + 1), NULL, 10), &glevel)) {
                 if (g_str_equal(*terms, "all")) {
-                    default_level = glevel;
+                    all_level = glevel;
                 } else {
-                    update_level_for_domain(*terms, glevel);
+                    g_hash_table_insert(domains, g_strdup(*terms), GINT_TO_POINTER(glevel));
                 }
             }
         }
@@ -195,8 +587,64 @@ void client_log_set_log_levels(const gchar * verbose_str) {
 
     g_strfreev(levels);
 
+    least = most = all_level;
+    g_hash_table_iter_init(&it, domains);
+    while (g_hash_table_iter_next(&it, NULL, &value)) {
+        least = MIN(least, GPOINTER_TO_INT(value));
+        most = MAX(most, GPOINTER_TO_INT(value));
+    }
+
+    g_rw_lock_writer_lock(&level_lock);
+    if (level_for_domains) g_hash_table_unref(level_for_domains);
+    level_for_domains = domains;
+    default_level = all_level;
+    g_atomic_int_set(&min_level, least);
+    g_atomic_int_set(&max_level, most);
+    g_rw_lock_writer_unlock(&level_lock);
+
     if (client_log_get_level_for_domain("GSpice") == G_LOG_LEVEL_DEBUG)
         g_setenv("SPICE_DEBUG", "1", TRUE);
     else
         g_unsetenv("SPICE_DEBUG");
 }
+
+
+/*
+ * Startup trace. Phases are marked from the main thread only, before the main
+ * loop is busy with anything else, so no locking is needed.
+ */
+#define MAX_STARTUP_PHASES 32
+
+static struct {
+    const gchar * phase;
+    gint64 time;
+} startup_phases[MAX_STARTUP_PHASES];
+static int num_startup_phases;
+
+
+void client_log_startup_mark(const gchar * phase) {
+    if (num_startup_phases < MAX_STARTUP_PHASES) {
+        startup_phases[num_startup_phases].phase = phase;
+        startup_phases[num_startup_phases++].time = g_get_monotonic_time();
+    }
+}
+
+
+void client_log_startup_report(gboolean print) {
+    int i;
+    if (num_startup_phases == 0) return;
+    gint64 start = startup_phases[0].time, last = start;
+    GString * report = g_string_new("Startup trace (ms since start, phase duration):\n");
+    for (i = 0; i < num_startup_phases; ++i) {
+        g_string_append_printf(report, "  %8.1f %8.1f  %s\n",
+            (startup_phases[i].time - start) / 1000.0,
+            (startup_phases[i].time - last) / 1000.0, startup_phases[i].phase);
+        last = startup_phases[i].time;
+    }
+    g_message("Startup took %.1f ms until %s", (last - start) / 1000.0,
+              startup_phases[num_startup_phases - 1].phase);
+    g_debug("%s", report->str);
+    if (print) g_print("%s", report->str);
+    g_string_free(report, TRUE);
+    num_startup_phases = 0;
+}
@@ -26,10 +26,26 @@
 /*
  * client_log_setup
  *
- * Setup logging file
+ * Setup logging file. These environment variables modify the default behaviour:
+ * - FLEXVDI_LOG_STDERR: log to stderr instead of a file.
+ * - FLEXVDI_LOG_FILE: path of the log file.
+ * - FLEXVDI_LOG_MAX_SIZE: size in KiB at which the log file is rotated, 0 to never
+ *   rotate it. Defaults to 10 MiB.
+ * - FLEXVDI_LOG_ARCHIVES: number of rotated log files kept, compressed. Defaults to 3.
+ * - FLEXVDI_LOG_FORMAT: 'json' to write JSON lines, with wall clock and monotonic
+ *   timestamps in microseconds, and thread ids.
+ * - FLEXVDI_FATAL_LEVEL: level (0 to 5) at which messages abort the program.
  */
 void client_log_setup();
 
+/*
+ * client_log_flush
+ *
+ * Wait until all the queued log messages have been written to the log file, and
+ * the rotated log files have been compressed.
+ */
+void client_log_flush();
+
 /*
  * client_log_set_log_levels
  *
@@ -48,6 +64,48 @@ void client_log_set_log_levels(const gchar * levels);
  */
 int client_log_get_level_for_domain(const gchar * domain);
 
+/*
+ * client_log_is_enabled
+ *
+ * Whether messages of a domain and level are logged. Most calls do not need to
+ * look up the domain, so it is cheap enough to use in hot paths.
+ */
+gboolean client_log_is_enabled(const gchar * domain, GLogLevelFlags level);
+
+/*
+ * client_log_debug_enabled
+ *
+ * Whether debug messages of the current log domain are logged. Use it to avoid
+ * building data that is only needed by debug messages.
+ */
+#define client_log_debug_enabled() client_log_is_enabled(G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG)
+
+/*
+ * CLIENT_DEBUG
+ *
+ * Like g_debug, but the arguments are not evaluated and the message is not
+ * formatted when debug messages of the current log domain are disabled.
+ */
+#define CLIENT_DEBUG(...) G_STMT_START { \
+    if (client_log_debug_enabled()) g_debug(__VA_ARGS__); \
+} G_STMT_END
+
+/*
+ * client_log_startup_mark
+ *
+ * Record the monotonic time at which a startup phase ends. The phase name must
+ * be a static string. Only call it from the main thread.
+ */
+void client_log_startup_mark(const gchar * phase);
+
+/*
+ * client_log_startup_report
+ *
+ * Log how long each startup phase took, and print it to stdout too if print is
+ * TRUE. The trace is cleared afterwards.
+ */
+void client_log_startup_report(gboolean print);
+
 /*
  * print_to_stdout
  *
@@ -22,6 +22,7 @@
 #include <json-glib/json-glib.h>
 
 #include "client-request.h"
+#include "client-log.h"
 
 
 // Hide the password value in a JSON text, to log it safely
@@ -42,15 +43,44 @@ static gchar * hide_json_password(const gchar * json_str) {
 }
 
 
+/*
+ * A request can be raced against several manager endpoints. Each endpoint gets its
+ * own attempt, with its own message and timings. The first successful response
+ * wins and the other attempts are cancelled.
+ */
+typedef struct RequestAttempt {
+    ClientRequest * req;
+    SoupMessage * msg;
+    GCancellable * cancellable;
+    gchar * endpoint;
+    ClientRequestTimings timings;
+} RequestAttempt;
+
+// Time to wait for an endpoint before trying the next one, in ms
+#define RACE_STAGGER_DELAY 300
+
+
 struct _ClientRequest {
     GObject parent;
+    ClientConf * conf;
     SoupSession * soup;
+    SoupMessage * msg;
     GCancellable * cancel_mgr_request;
     JsonParser * parser;
     ClientRequestCallback cb;
     gpointer user_data;
     GError * error;
     GInputStream * stream;
+    ClientRequestTimings timings;
+    gsize body_size;
+    const gchar * method;
+    gchar * path;
+    gchar * post_data;
+    gchar ** endpoints;
+    guint next_endpoint;
+    GList * attempts;
+    guint stagger_id;
+    gboolean race;
 };
 
 G_DEFINE_TYPE(ClientRequest, client_request, G_TYPE_OBJECT);
@@ -58,23 +88,29 @@ G_DEFINE_TYPE(ClientRequest, client_request, G_TYPE_OBJECT);
 
 static void client_request_init(ClientRequest * req) {
     req->cancel_mgr_request = g_cancellable_new();
+    req->timings.start = g_get_monotonic_time();
 }
 
 
 static void client_request_dispose(GObject * obj) {
     ClientRequest * req = CLIENT_REQUEST(obj);
 
-    if (req->cancel_mgr_request)
-        g_cancellable_cancel(req->cancel_mgr_request);
+    client_request_cancel(req);
     g_clear_object(&req->cancel_mgr_request);
     g_clear_object(&req->parser);
     g_clear_object(&req->stream);
+    g_clear_object(&req->msg);
+    g_clear_object(&req->conf);
 
     G_OBJECT_CLASS(client_request_parent_class)->dispose(obj);
 }
 
 
 static void client_request_finalize(GObject * obj) {
+    ClientRequest * req = CLIENT_REQUEST(obj);
+    g_free(req->path);
+    g_free(req->post_data);
+    g_strfreev(req->endpoints);
     G_OBJECT_CLASS(client_request_parent_class)->finalize(obj);
 }
 
@@ -86,7 +122,27 @@ static void client_request_class_init(ClientRequestClass * class) {
 }
 
 
+static void stop_stagger_timer(ClientRequest * req) {
+    if (req->stagger_id) {
+        g_source_remove(req->stagger_id);
+        req->stagger_id = 0;
+    }
+}
+
+
+// Cancel the attempts that are still running
+static void cancel_attempts(ClientRequest * req) {
+    GList * it;
+    stop_stagger_timer(req);
+    for (it = req->attempts; it; it = it->next) {
+        RequestAttempt * attempt = it->data;
+        g_cancellable_cancel(attempt->cancellable);
+    }
+}
+
+
 void client_request_cancel(ClientRequest * req) {
+    cancel_attempts(req);
     if (req->cancel_mgr_request) {
         g_cancellable_cancel(req->cancel_mgr_request);
     }
@@ -104,28 +160,99 @@ JsonNode * client_request_get_result(ClientRequest * req, GError ** error) {
 }
 
 
+const ClientRequestTimings * client_request_get_timings(ClientRequest * req) {
+    return &req->timings;
+}
+
+
+/*
+ * SoupMessage signal handlers, to record the timings.
+ */
+static void network_event_cb(SoupMessage * msg, GSocketClientEvent event,
+                             GIOStream * connection, gpointer user_data) {
+    RequestAttempt * attempt = user_data;
+    switch (event) {
+        case G_SOCKET_CLIENT_RESOLVED: attempt->timings.resolve = g_get_monotonic_time(); break;
+        case G_SOCKET_CLIENT_CONNECTED: attempt->timings.connect = g_get_monotonic_time(); break;
+        case G_SOCKET_CLIENT_TLS_HANDSHAKED: attempt->timings.tls = g_get_monotonic_time(); break;
+        default:;
+    }
+}
+
+
+static void request_sent_cb(SoupMessage * msg, gpointer user_data) {
+    ((RequestAttempt *)user_data)->timings.request_sent = g_get_monotonic_time();
+}
+
+
+static void got_headers_cb(SoupMessage * msg, gpointer user_data) {
+    ((RequestAttempt *)user_data)->timings.first_byte = g_get_monotonic_time();
+}
+
+
+// Time in ms between two phases, or since the previous phase that happened
+static double phase_ms(gint64 end, gint64 * last) {
+    if (!end) return 0.0;
+    double ms = (end - *last) / 1000.0;
+    *last = end;
+    return ms;
+}
+
+
+static void log_timings(ClientRequest * req) {
+    ClientRequestTimings * t = &req->timings;
+    gint64 last = t->start;
+    double resolve = phase_ms(t->resolve, &last);
+    double connect = phase_ms(t->connect, &last);
+    double tls = phase_ms(t->tls, &last);
+    double sent = phase_ms(t->request_sent, &last);
+    double wait = phase_ms(t->first_byte, &last);
+    double body = phase_ms(t->body_complete, &last);
+    double parse = phase_ms(t->parse_complete, &last);
+    g_message("%s %s: status %u, %" G_GSIZE_FORMAT " bytes in %.1f ms "
+              "(resolve %.1f, connect %.1f, tls %.1f, send %.1f, wait %.1f, body %.1f, parse %.1f)",
+              req->msg->method, soup_message_get_uri(req->msg)->path, req->msg->status_code,
+              req->body_size, (last - t->start) / 1000.0,
+              resolve, connect, tls, sent, wait, body, parse);
+}
+
+
 /*
- * Request parsed handler. Calls the callback on success.
+ * Request body read handler. Parses the response and calls the callback.
  */
-static void request_parsed_cb(GObject * object, GAsyncResult * res, gpointer user_data) {
+static void request_read_cb(GObject * object, GAsyncResult * res, gpointer user_data) {
     ClientRequest * req = CLIENT_REQUEST(user_data);
+    GMemoryOutputStream * body = G_MEMORY_OUTPUT_STREAM(object);
     GError * error = NULL;
 
-    json_parser_load_from_stream_finish(JSON_PARSER(object), res, &error);
+    g_output_stream_splice_finish(G_OUTPUT_STREAM(body), res, &error);
     if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
         g_debug("Request cancelled");
+        g_error_free(error);
+        g_object_unref(body);
         g_object_unref(req);
         return;
     }
 
+    req->timings.body_complete = g_get_monotonic_time();
     req->error = error;
     if (!req->error) {
+        req->body_size = g_memory_output_stream_get_data_size(body);
+        req->parser = json_parser_new();
+        json_parser_load_from_data(req->parser, g_memory_output_stream_get_data(body),
+                                   req->body_size, &req->error);
+        req->timings.parse_complete = g_get_monotonic_time();
+    }
+    g_object_unref(body);
+
+    if (!req->error && client_log_debug_enabled()) {
         g_autoptr(JsonGenerator) gen = json_generator_new();
         json_generator_set_root(gen, json_parser_get_root(req->parser));
         g_autofree gchar * response = json_generator_to_data(gen, NULL);
         g_autofree gchar * safe_response = hide_json_password(response);
         g_debug("request response:\n%s", safe_response);
     }
+    log_timings(req);
 
     req->cb(req, req->user_data);
     g_input_stream_close(req->stream, NULL, NULL);
@@ -134,67 +261,199 @@ static void request_parsed_cb(GObject * object, GAsyncResult * res, gpointer use
 
 
 /*
- * Request finished handler. It checks whether the request was cancelled, and starts
- * parsing the response body.
+ * Take the result of an attempt as the result of the request. The other attempts
+ * are cancelled, and the response body is read.
+ */
+static void accept_attempt(ClientRequest * req, RequestAttempt * attempt,
+                           GInputStream * stream, GError * error) {
+    cancel_attempts(req);
+    req->msg = g_object_ref(attempt->msg);
+    req->timings = attempt->timings;
+    req->error = error;
+    if (req->race && !error && SOUP_STATUS_IS_SUCCESSFUL(attempt->msg->status_code)) {
+        g_message("Using manager endpoint %s", attempt->endpoint);
+        client_conf_set_active_endpoint(req->conf, attempt->endpoint);
+    }
+
+    if (req->error) {
+        log_timings(req);
+        req->cb(req, req->user_data);
+    } else {
+        req->stream = stream;
+        GOutputStream * body = g_memory_output_stream_new_resizable();
+        g_output_stream_splice_async(body, stream, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                     G_PRIORITY_DEFAULT, req->cancel_mgr_request,
+                                     request_read_cb, g_object_ref(req));
+    }
+}
+
+
+static void free_attempt(RequestAttempt * attempt) {
+    g_signal_handlers_disconnect_by_data(attempt->msg, attempt);
+    g_object_unref(attempt->msg);
+    g_object_unref(attempt->cancellable);
+    g_free(attempt->endpoint);
+    g_free(attempt);
+}
+
+
+static void start_attempts(ClientRequest * req);
+
+
+/*
+ * Request finished handler. It checks whether the request was cancelled, and whether
+ * other attempts may still give a better result. Otherwise, the attempt wins.
  */
 static void request_finished_cb(GObject * object, GAsyncResult * result, gpointer user_data) {
-    ClientRequest * req = CLIENT_REQUEST(user_data);
+    RequestAttempt * attempt = user_data;
+    ClientRequest * req = attempt->req;
     GError * error = NULL;
     GInputStream * stream = soup_session_send_finish(SOUP_SESSION(object), result, &error);
+    req->attempts = g_list_remove(req->attempts, attempt);
+    gboolean pending = req->attempts || req->endpoints[req->next_endpoint];
 
     if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-        g_debug("Request cancelled");
-        g_object_unref(req);
-        return;
+        g_debug("Request to %s cancelled", attempt->endpoint);
+        g_error_free(error);
+    } else if (pending && (error || !SOUP_STATUS_IS_SUCCESSFUL(attempt->msg->status_code))) {
+        // Fail over to the other endpoints
+        if (error) {
+            g_message("Request to %s failed: %s", attempt->endpoint, error->message);
+            g_error_free(error);
+        } else {
+            g_message("Request to %s failed: status %u", attempt->endpoint,
+                      attempt->msg->status_code);
+            g_input_stream_close(stream, NULL, NULL);
+            g_object_unref(stream);
+        }
+        if (req->endpoints[req->next_endpoint])
+            start_attempts(req);
+    } else {
+        accept_attempt(req, attempt, stream, error);
     }
 
-    req->error = error;
-    req->stream = g_object_ref(stream);
-    if (req->error) {
-        req->cb(req, req->user_data);
-        g_object_unref(req);
+    free_attempt(attempt);
+    g_object_unref(req);
+}
+
+
+static void start_attempt(ClientRequest * req) {
+    RequestAttempt * attempt = g_new0(RequestAttempt, 1);
+    attempt->req = req;
+    attempt->endpoint = g_strdup(req->endpoints[req->next_endpoint++]);
+    attempt->cancellable = g_cancellable_new();
+    attempt->timings.start = req->timings.start;
+
+    g_autofree gchar * uri = g_strconcat(attempt->endpoint, req->path, NULL);
+    attempt->msg = soup_message_new(req->method, uri);
+    if (req->post_data) {
+        if (client_log_debug_enabled()) {
+            g_autofree gchar * safe_post_data = hide_json_password(req->post_data);
+            g_debug("POST request to %s, body:\n%s", uri, safe_post_data);
+        }
+        soup_message_set_request(attempt->msg, "text/json", SOUP_MEMORY_COPY,
+                                 req->post_data, strlen(req->post_data));
     } else {
-        req->parser = json_parser_new();
-        json_parser_load_from_stream_async(req->parser, stream, req->cancel_mgr_request,
-                                           request_parsed_cb, req);
+        g_debug("GET request to %s", uri);
     }
+
+    g_signal_connect(attempt->msg, "network-event", G_CALLBACK(network_event_cb), attempt);
+    g_signal_connect(attempt->msg, "wrote-body", G_CALLBACK(request_sent_cb), attempt);
+    g_signal_connect(attempt->msg, "got-headers", G_CALLBACK(got_headers_cb), attempt);
+    req->attempts = g_list_prepend(req->attempts, attempt);
+    soup_session_send_async(req->soup, attempt->msg, attempt->cancellable,
+                            request_finished_cb, attempt);
+    g_object_ref(req);
+}
+
+
+static gboolean stagger_cb(gpointer user_data) {
+    ClientRequest * req = CLIENT_REQUEST(user_data);
+    start_attempt(req);
+    if (req->endpoints[req->next_endpoint])
+        return G_SOURCE_CONTINUE;
+    req->stagger_id = 0;
+    return G_SOURCE_REMOVE;
 }
 
 
-static ClientRequest * client_request_new_base(ClientConf * conf,
+/*
+ * Start an attempt with the next endpoint now, and the rest of them staggered, so
+ * that a slow endpoint does not delay the request more than RACE_STAGGER_DELAY ms.
+ */
+static void start_attempts(ClientRequest * req) {
+    stop_stagger_timer(req);
+    start_attempt(req);
+    if (req->endpoints[req->next_endpoint])
+        req->stagger_id = g_timeout_add(RACE_STAGGER_DELAY, stagger_cb, req);
+}
+
+
+static gboolean no_endpoint_cb(gpointer user_data) {
+    ClientRequest * req = CLIENT_REQUEST(user_data);
+    if (!g_cancellable_is_cancelled(req->cancel_mgr_request))
+        req->cb(req, req->user_data);
+    g_object_unref(req);
+    return G_SOURCE_REMOVE;
+}
+
+
+static ClientRequest * client_request_new_full(ClientConf * conf, SoupSession * soup,
+        const gchar * path, const gchar * post_data, gboolean race,
         ClientRequestCallback cb, gpointer user_data) {
     ClientRequest * req = CLIENT_REQUEST(g_object_new(CLIENT_REQUEST_TYPE, NULL));
     req->cb = cb;
     req->user_data = user_data;
-    req->soup = client_conf_get_soup_session(conf);
+    req->conf = g_object_ref(conf);
+    req->soup = soup;
+    req->method = post_data ? "POST" : "GET";
+    req->path = g_strdup(path);
+    req->post_data = g_strdup(post_data);
+    req->race = race;
+    if (race) {
+        req->endpoints = client_conf_get_manager_endpoints(conf);
+    } else {
+        // Use the active endpoint, or the first one
+        g_autofree gchar * base_uri = client_conf_get_connection_uri(conf, "");
+        req->endpoints = g_new0(gchar *, 2);
+        req->endpoints[0] = g_steal_pointer(&base_uri);
+    }
+
+    if (req->endpoints && req->endpoints[0]) {
+        start_attempts(req);
+    } else {
+        req->error = g_error_new(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                 "No manager host configured");
+        g_idle_add(no_endpoint_cb, g_object_ref(req));
+    }
+
     return req;
 }
 
+
 ClientRequest * client_request_new(ClientConf * conf, const gchar * path,
         ClientRequestCallback cb, gpointer user_data) {
-    ClientRequest * req = client_request_new_base(conf, cb, user_data);
+    return client_request_new_full(conf, client_conf_get_soup_session(conf),
+                                   path, NULL, FALSE, cb, user_data);
+}
 
-    g_autofree gchar * uri = client_conf_get_connection_uri(conf, path);
-    SoupMessage * msg = soup_message_new("GET", uri);
-    g_debug("GET request to %s", uri);
-    soup_session_send_async(req->soup, msg, req->cancel_mgr_request,
-                            request_finished_cb, g_object_ref(req));
 
-    return req;
+ClientRequest * client_request_new_with_data(ClientConf * conf, const gchar * path,
+        const gchar * post_data, ClientRequestCallback cb, gpointer user_data) {
+    return client_request_new_full(conf, client_conf_get_soup_session(conf),
+                                   path, post_data, FALSE, cb, user_data);
 }
 
 
-ClientRequest * client_request_new_with_data(ClientConf * conf, const gchar * path,
+ClientRequest * client_request_new_long_poll(ClientConf * conf, const gchar * path,
         const gchar * post_data, ClientRequestCallback cb, gpointer user_data) {
-    ClientRequest * req = client_request_new_base(conf, cb, user_data);
+    return client_request_new_full(conf, client_conf_get_long_poll_soup_session(conf),
+                                   path, post_data, FALSE, cb, user_data);
+}
 
-    g_autofree gchar * uri = client_conf_get_connection_uri(conf, path);
-    SoupMessage * msg = soup_message_new("POST", uri);
-    g_autofree gchar * safe_post_data = hide_json_password(post_data);
-    g_debug("POST request to %s, body:\n%s", uri, safe_post_data);
-    soup_message_set_request(msg, "text/json", SOUP_MEMORY_COPY, post_data, strlen(post_data));
-    soup_session_send_async(req->soup, msg, req->cancel_mgr_request,
-                            request_finished_cb, g_object_ref(req));
 
-    return req;
+ClientRequest * client_request_race(ClientConf * conf, const gchar * path,
+        const gchar * post_data, ClientRequestCallback cb, gpointer user_data) {
+    return client_request_new_full(conf, client_conf_get_soup_session(conf),
+                                   path, post_data, TRUE, cb, user_data);
 }
@@ -54,6 +54,27 @@ ClientRequest * client_request_new(ClientConf * conf, const gchar * path,
 ClientRequest * client_request_new_with_data(ClientConf * conf, const gchar * path,
     const gchar * post_data, ClientRequestCallback cb, gpointer user_data);
 
+/*
+ * client_request_new_long_poll
+ *
+ * Like client_request_new_with_data, for a request that the manager may hold for
+ * up to desktop-long-poll seconds. Other requests keep their short timeout.
+ */
+ClientRequest * client_request_new_long_poll(ClientConf * conf, const gchar * path,
+    const gchar * post_data, ClientRequestCallback cb, gpointer user_data);
+
+/*
+ * client_request_race
+ *
+ * Create a new request, GET or POST if post_data is not NULL, to every manager
+ * endpoint in the configuration. Endpoints are tried in order, each one a short
+ * time after the previous one or right after it fails. The first successful
+ * response is passed to the callback, and its endpoint is used by the following
+ * requests.
+ */
+ClientRequest * client_request_race(ClientConf * conf, const gchar * path,
+    const gchar * post_data, ClientRequestCallback cb, gpointer user_data);
+
 /*
  * client_request_cancel
  * 
@@ -68,5 +89,30 @@ void client_request_cancel(ClientRequest * req);
  */
 JsonNode * client_request_get_result(ClientRequest * req, GError ** error);
 
+/*
+ * ClientRequestTimings
+ *
+ * When each phase of a request finished, in monotonic time (microseconds). Phases
+ * that did not happen are 0, like name resolution, connection and TLS handshake
+ * when the request reuses a connection.
+ */
+typedef struct ClientRequestTimings {
+    gint64 start;           // The request was created
+    gint64 resolve;         // Host name resolved
+    gint64 connect;         // TCP connection established
+    gint64 tls;             // TLS handshake done
+    gint64 request_sent;    // Request written to the connection
+    gint64 first_byte;      // Response headers received
+    gint64 body_complete;   // Response body received
+    gint64 parse_complete;  // Response body parsed
+} ClientRequestTimings;
+
+/*
+ * client_request_get_timings
+ *
+ * Get the timings of a request. They are complete when the callback is called.
+ */
+const ClientRequestTimings * client_request_get_timings(ClientRequest * req);
+
 
 #endif /* _CLIENT_REQUEST_H */
@@ -0,0 +1,226 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "client-scheduler.h"
+
+
+typedef struct Timer {
+    gint64 deadline;
+    gint64 interval;      // In us
+    gboolean coalesce;    // Expire on whole seconds
+    guint id;
+    GSourceFunc func;
+    gpointer user_data;
+} Timer;
+
+struct _ClientScheduler {
+    GObject parent;
+    GSource * source;
+    GArray * heap;        // Binary min-heap of Timers, by deadline
+    guint next_id;
+    guint running_id;     // Timer whose callback is running
+    gboolean running_removed;
+};
+
+G_DEFINE_TYPE(ClientScheduler, client_scheduler, G_TYPE_OBJECT);
+
+
+static void client_scheduler_dispose(GObject * obj);
+static void client_scheduler_finalize(GObject * obj);
+
+static void client_scheduler_class_init(ClientSchedulerClass * class) {
+    GObjectClass * object_class = G_OBJECT_CLASS(class);
+    object_class->dispose = client_scheduler_dispose;
+    object_class->finalize = client_scheduler_finalize;
+}
+
+
+static gboolean source_dispatch(GSource * source, GSourceFunc callback, gpointer user_data) {
+    return callback(user_data);
+}
+
+// Without prepare and check functions, the source is ready at its ready time
+static GSourceFuncs source_funcs = {
+    NULL, NULL, source_dispatch, NULL
+};
+
+static gboolean run_timers(gpointer user_data);
+
+static void client_scheduler_init(ClientScheduler * scheduler) {
+    scheduler->heap = g_array_new(FALSE, FALSE, sizeof(Timer));
+    scheduler->source = g_source_new(&source_funcs, sizeof(GSource));
+    g_source_set_callback(scheduler->source, run_timers, scheduler, NULL);
+    g_source_attach(scheduler->source, NULL);
+}
+
+
+static void client_scheduler_dispose(GObject * obj) {
+    ClientScheduler * scheduler = CLIENT_SCHEDULER(obj);
+    if (scheduler->source) {
+        g_source_destroy(scheduler->source);
+        g_clear_pointer(&scheduler->source, g_source_unref);
+    }
+    G_OBJECT_CLASS(client_scheduler_parent_class)->dispose(obj);
+}
+
+
+static void client_scheduler_finalize(GObject * obj) {
+    ClientScheduler * scheduler = CLIENT_SCHEDULER(obj);
+    g_array_unref(scheduler->heap);
+    G_OBJECT_CLASS(client_scheduler_parent_class)->finalize(obj);
+}
+
+
+ClientScheduler * client_scheduler_new(void) {
+    return CLIENT_SCHEDULER(g_object_new(CLIENT_SCHEDULER_TYPE, NULL));
+}
+
+
+#define TIMER(i) (&g_array_index(scheduler->heap, Timer, (i)))
+
+static void swap_timers(ClientScheduler * scheduler, guint i, guint j) {
+    Timer tmp = *TIMER(i);
+    *TIMER(i) = *TIMER(j);
+    *TIMER(j) = tmp;
+}
+
+
+static void sift_up(ClientScheduler * scheduler, guint i) {
+    while (i > 0 && TIMER(i)->deadline < TIMER((i - 1) / 2)->deadline) {
+        swap_timers(scheduler, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+
+static void sift_down(ClientScheduler * scheduler, guint i) {
+    guint len = scheduler->heap->len;
+    while (TRUE) {
+        guint min = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < len && TIMER(left)->deadline < TIMER(min)->deadline) min = left;
+        if (right < len && TIMER(right)->deadline < TIMER(min)->deadline) min = right;
+        if (min == i) break;
+        swap_timers(scheduler, i, min);
+        i = min;
+    }
+}
+
+
+static void remove_timer_at(ClientScheduler * scheduler, guint i) {
+    guint last = scheduler->heap->len - 1;
+    if (i != last) {
+        swap_timers(scheduler, i, last);
+        g_array_set_size(scheduler->heap, last);
+        sift_up(scheduler, i);
+        sift_down(scheduler, i);
+    } else {
+        g_array_set_size(scheduler->heap, last);
+    }
+}
+
+
+/*
+ * Wake up when the earliest timer expires, or never if there are no timers.
+ */
+static void update_ready_time(ClientScheduler * scheduler) {
+    if (scheduler->source)
+        g_source_set_ready_time(scheduler->source,
+            scheduler->heap->len ? TIMER(0)->deadline : -1);
+}
+
+
+static void schedule_timer(ClientScheduler * scheduler, Timer * timer, gint64 now) {
+    // At least 1us, so that run_timers does not run the timer again right away
+    timer->deadline = now + MAX(timer->interval, 1);
+    if (timer->coalesce) {
+        // Round up to the next whole second
+        timer->deadline += G_USEC_PER_SEC - 1;
+        timer->deadline -= timer->deadline % G_USEC_PER_SEC;
+    }
+    g_array_append_val(scheduler->heap, *timer);
+    sift_up(scheduler, scheduler->heap->len - 1);
+}
+
+
+static gboolean run_timers(gpointer user_data) {
+    ClientScheduler * scheduler = CLIENT_SCHEDULER(user_data);
+    gint64 now = g_get_monotonic_time();
+
+    g_object_ref(scheduler);
+    while (scheduler->heap->len && TIMER(0)->deadline <= now) {
+        Timer timer = *TIMER(0);
+        remove_timer_at(scheduler, 0);
+        scheduler->running_id = timer.id;
+        scheduler->running_removed = FALSE;
+        gboolean again = timer.func(timer.user_data);
+        scheduler->running_id = 0;
+        if (again && !scheduler->running_removed)
+            schedule_timer(scheduler, &timer, now);
+    }
+    update_ready_time(scheduler);
+    g_object_unref(scheduler);
+
+    return G_SOURCE_CONTINUE;
+}
+
+
+static guint add_timer(ClientScheduler * scheduler, gint64 interval, gboolean coalesce,
+                       GSourceFunc func, gpointer user_data) {
+    Timer timer = {
+        .interval = interval,
+        .coalesce = coalesce,
+        .func = func,
+        .user_data = user_data,
+    };
+    do {
+        timer.id = ++scheduler->next_id;
+    } while (timer.id == 0);
+    schedule_timer(scheduler, &timer, g_get_monotonic_time());
+    update_ready_time(scheduler);
+    return timer.id;
+}
+
+
+guint client_scheduler_add(ClientScheduler * scheduler, guint interval,
+                           GSourceFunc func, gpointer user_data) {
+    return add_timer(scheduler, (gint64)interval * 1000, FALSE, func, user_data);
+}
+
+
+guint client_scheduler_add_seconds(ClientScheduler * scheduler, guint interval,
+                                   GSourceFunc func, gpointer user_data) {
+    return add_timer(scheduler, (gint64)interval * G_USEC_PER_SEC, TRUE, func, user_data);
+}
+
+
+void client_scheduler_remove(ClientScheduler * scheduler, guint id) {
+    guint i;
+    if (id == 0) return;
+    if (id == scheduler->running_id) {
+        scheduler->running_removed = TRUE;
+        return;
+    }
+    for (i = 0; i < scheduler->heap->len; ++i) {
+        if (TIMER(i)->id == id) {
+            remove_timer_at(scheduler, i);
+            update_ready_time(scheduler);
+            return;
+        }
+    }
+}
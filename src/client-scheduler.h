@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CLIENT_SCHEDULER_H
+#define _CLIENT_SCHEDULER_H
+
+#include <glib-object.h>
+
+
+/*
+ * ClientScheduler
+ *
+ * Runs many housekeeping timers on a single GSource of the default main context,
+ * so that adding or re-arming a timer does not create a new GSource, and the
+ * process only wakes up when the earliest timer expires. Timers that do not need
+ * to be precise can be coalesced on whole seconds. Like GLib timeouts, callbacks
+ * are called in the main thread, and are called again after the same interval
+ * while they return G_SOURCE_CONTINUE.
+ */
+#define CLIENT_SCHEDULER_TYPE (client_scheduler_get_type())
+G_DECLARE_FINAL_TYPE(ClientScheduler, client_scheduler, CLIENT, SCHEDULER, GObject)
+
+/*
+ * client_scheduler_new
+ *
+ * Create a new scheduler, attached to the default main context.
+ */
+ClientScheduler * client_scheduler_new(void);
+
+/*
+ * client_scheduler_add
+ *
+ * Call func after interval milliseconds. Return a handle for client_scheduler_remove,
+ * never 0.
+ */
+guint client_scheduler_add(ClientScheduler * scheduler, guint interval,
+                           GSourceFunc func, gpointer user_data);
+
+/*
+ * client_scheduler_add_seconds
+ *
+ * Like client_scheduler_add, with the interval in seconds. The timer may expire up
+ * to one second later, to share the wake up with other timers.
+ */
+guint client_scheduler_add_seconds(ClientScheduler * scheduler, guint interval,
+                                   GSourceFunc func, gpointer user_data);
+
+/*
+ * client_scheduler_remove
+ *
+ * Cancel a timer. Handles of timers that already expired are ignored.
+ */
+void client_scheduler_remove(ClientScheduler * scheduler, guint id);
+
+#endif /* _CLIENT_SCHEDULER_H */
@@ -0,0 +1,167 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <json-glib/json-glib.h>
+
+#include "client-timeline.h"
+
+
+typedef struct TimelineEvent {
+    gchar * name;
+    gint64 time;
+    gint64 duration;  // -1 for instant events
+    guint thread;
+} TimelineEvent;
+
+// Stop recording after this many events, e.g. with a flapping connection
+#define MAX_EVENTS 1024
+
+static GMutex timeline_mutex;
+static GArray * events = NULL;
+static gint64 origin = 0;
+
+
+static void clear_event(gpointer data) {
+    g_free(((TimelineEvent *)data)->name);
+}
+
+
+static void init_events(void) {
+    if (!events) {
+        events = g_array_new(FALSE, FALSE, sizeof(TimelineEvent));
+        g_array_set_clear_func(events, clear_event);
+        origin = g_get_monotonic_time();
+    }
+}
+
+
+void client_timeline_reset(void) {
+    g_mutex_lock(&timeline_mutex);
+    init_events();
+    g_array_set_size(events, 0);
+    origin = g_get_monotonic_time();
+    g_mutex_unlock(&timeline_mutex);
+}
+
+
+static void add_event(gint64 start, gint64 end, const gchar * format, va_list args) {
+    TimelineEvent event = {
+        .time = start,
+        .duration = end >= 0 ? end - start : -1,
+        .thread = GPOINTER_TO_UINT(g_thread_self()),
+    };
+
+    g_mutex_lock(&timeline_mutex);
+    init_events();
+    if (events->len < MAX_EVENTS) {
+        event.name = g_strdup_vprintf(format, args);
+        g_array_append_val(events, event);
+    }
+    g_mutex_unlock(&timeline_mutex);
+}
+
+
+void client_timeline_mark(const gchar * format, ...) {
+    va_list args;
+    va_start(args, format);
+    add_event(g_get_monotonic_time(), -1, format, args);
+    va_end(args);
+}
+
+
+void client_timeline_span(gint64 start, const gchar * format, ...) {
+    va_list args;
+    va_start(args, format);
+    add_event(start, g_get_monotonic_time(), format, args);
+    va_end(args);
+}
+
+
+void client_timeline_log(void) {
+    guint i;
+    g_mutex_lock(&timeline_mutex);
+    init_events();
+    GString * text = g_string_new("Connection timeline (ms since start, duration):");
+    for (i = 0; i < events->len; ++i) {
+        TimelineEvent * event = &g_array_index(events, TimelineEvent, i);
+        g_string_append_printf(text, "\n  %8.1f ", (event->time - origin) / 1000.0);
+        if (event->duration >= 0)
+            g_string_append_printf(text, "%8.1f  ", event->duration / 1000.0);
+        else
+            g_string_append(text, "          ");
+        g_string_append(text, event->name);
+    }
+    g_mutex_unlock(&timeline_mutex);
+    g_message("%s", text->str);
+    g_string_free(text, TRUE);
+}
+
+
+gchar * client_timeline_to_json(void) {
+    guint i;
+    g_autoptr(JsonBuilder) builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "displayTimeUnit");
+    json_builder_add_string_value(builder, "ms");
+    json_builder_set_member_name(builder, "traceEvents");
+    json_builder_begin_array(builder);
+
+    g_mutex_lock(&timeline_mutex);
+    init_events();
+    for (i = 0; i < events->len; ++i) {
+        TimelineEvent * event = &g_array_index(events, TimelineEvent, i);
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "name");
+        json_builder_add_string_value(builder, event->name);
+        json_builder_set_member_name(builder, "cat");
+        json_builder_add_string_value(builder, "flexvdi");
+        json_builder_set_member_name(builder, "ph");
+        json_builder_add_string_value(builder, event->duration >= 0 ? "X" : "i");
+        json_builder_set_member_name(builder, "ts");
+        json_builder_add_int_value(builder, event->time - origin);
+        if (event->duration >= 0) {
+            json_builder_set_member_name(builder, "dur");
+            json_builder_add_int_value(builder, event->duration);
+        } else {
+            // Instant events span the whole process
+            json_builder_set_member_name(builder, "s");
+            json_builder_add_string_value(builder, "p");
+        }
+        json_builder_set_member_name(builder, "pid");
+        json_builder_add_int_value(builder, 1);
+        json_builder_set_member_name(builder, "tid");
+        json_builder_add_int_value(builder, event->thread);
+        json_builder_end_object(builder);
+    }
+    g_mutex_unlock(&timeline_mutex);
+
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    g_autoptr(JsonGenerator) gen = json_generator_new();
+    g_autoptr(JsonNode) root = json_builder_get_root(builder);
+    json_generator_set_root(gen, root);
+    return json_generator_to_data(gen, NULL);
+}
+
+
+gboolean client_timeline_save(const gchar * file_name, GError ** error) {
+    g_autofree gchar * json = client_timeline_to_json();
+    return g_file_set_contents(file_name, json, -1, error);
+}
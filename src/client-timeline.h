@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CLIENT_TIMELINE_H
+#define _CLIENT_TIMELINE_H
+
+#include <glib.h>
+
+
+/*
+ * Connection timeline
+ *
+ * Events that happen from login to the first frame and afterwards, like requests to
+ * the manager, channels being opened or the guest agent connecting, with their
+ * monotonic time. The timeline can be logged, and exported in the Chrome trace event
+ * format, that chrome://tracing and Perfetto load. Events can be recorded from any
+ * thread.
+ */
+
+/*
+ * client_timeline_reset
+ *
+ * Forget all the events and start a new timeline, e.g. when the user logs in.
+ */
+void client_timeline_reset(void);
+
+/*
+ * client_timeline_mark
+ *
+ * Record an instant event.
+ */
+void client_timeline_mark(const gchar * format, ...) G_GNUC_PRINTF(1, 2);
+
+/*
+ * client_timeline_span
+ *
+ * Record an event that started at the given monotonic time and ends now.
+ */
+void client_timeline_span(gint64 start, const gchar * format, ...) G_GNUC_PRINTF(2, 3);
+
+/*
+ * client_timeline_log
+ *
+ * Log the events recorded so far, with their time since the timeline started.
+ */
+void client_timeline_log(void);
+
+/*
+ * client_timeline_to_json
+ *
+ * Get the events recorded so far in the Chrome trace event format.
+ */
+gchar * client_timeline_to_json(void);
+
+/*
+ * client_timeline_save
+ *
+ * Write the events recorded so far to a file, in the Chrome trace event format.
+ */
+gboolean client_timeline_save(const gchar * file_name, GError ** error);
+
+#endif /* _CLIENT_TIMELINE_H */
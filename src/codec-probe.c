@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <gst/gst.h>
+#include <spice-client.h>
+
+#include "codec-probe.h"
+
+
+typedef struct CodecInfo {
+    gint type;
+    const gchar * name;
+    const gchar * caps;
+} CodecInfo;
+
+static const CodecInfo codecs[] = {
+    { SPICE_VIDEO_CODEC_TYPE_MJPEG, "mjpeg", "image/jpeg" },
+    { SPICE_VIDEO_CODEC_TYPE_VP8, "vp8", "video/x-vp8" },
+    { SPICE_VIDEO_CODEC_TYPE_VP9, "vp9", "video/x-vp9" },
+    { SPICE_VIDEO_CODEC_TYPE_H264, "h264", "video/x-h264" },
+    { SPICE_VIDEO_CODEC_TYPE_H265, "h265", "video/x-h265" },
+};
+
+// The clips, like a window being moved around, see resources/clips/make-clip.cmake
+#define CLIP_PATH "/com/flexvdi/client/clips/%s.mkv"
+#define CLIP_FRAMES 30
+// The first run also loads the decoder, the best one is kept
+#define DECODE_RUNS 2
+// Give up on a pipeline after this time, in ns
+#define PIPELINE_TIMEOUT (10 * GST_SECOND)
+
+typedef struct CodecCost {
+    gint type;
+    gint64 time;
+} CodecCost;
+
+
+static gint compare_plugins(gconstpointer a, gconstpointer b) {
+    return g_strcmp0(gst_plugin_get_name(GST_PLUGIN(a)), gst_plugin_get_name(GST_PLUGIN(b)));
+}
+
+
+gchar * codec_probe_get_key(void) {
+    g_autoptr(GChecksum) checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_autofree gchar * gst_version = gst_version_string();
+    GList * plugins, * plugin;
+
+    // The clips may change with the client
+    g_checksum_update(checksum, (const guchar *)VERSION_STRING, -1);
+    g_checksum_update(checksum, (const guchar *)gst_version, -1);
+    plugins = g_list_sort(gst_registry_get_plugin_list(gst_registry_get()), compare_plugins);
+    for (plugin = plugins; plugin != NULL; plugin = plugin->next) {
+        g_autofree gchar * id = g_strdup_printf(";%s:%s",
+            gst_plugin_get_name(GST_PLUGIN(plugin->data)),
+            gst_plugin_get_version(GST_PLUGIN(plugin->data)));
+        g_checksum_update(checksum, (const guchar *)id, -1);
+    }
+    gst_plugin_list_free(plugins);
+    return g_strdup(g_checksum_get_string(checksum));
+}
+
+
+/*
+ * Decode a clip until the end of stream. Return how long it took in microseconds,
+ * or -1 on error.
+ */
+static gint64 decode_clip(const gchar * path) {
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GInputStream) stream = g_resources_open_stream(path, 0, &error);
+    gint64 time = -1;
+
+    if (!stream) {
+        g_debug("Codec probe: %s", error->message);
+        return -1;
+    }
+    GstElement * pipeline = gst_parse_launch_full(
+        "giostreamsrc name=src ! matroskademux ! decodebin ! fakesink sync=false",
+        NULL, GST_PARSE_FLAG_FATAL_ERRORS, &error);
+    if (!pipeline) {
+        g_debug("Codec probe: %s", error->message);
+        return -1;
+    }
+    GstElement * src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(src, "stream", stream, NULL);
+    gst_object_unref(src);
+
+    GstBus * bus = gst_element_get_bus(pipeline);
+    gint64 start = g_get_monotonic_time();
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE) {
+        GstMessage * msg = gst_bus_timed_pop_filtered(bus, PIPELINE_TIMEOUT,
+            GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+            time = g_get_monotonic_time() - start;
+        } else if (msg) {
+            gst_message_parse_error(msg, &error, NULL);
+            g_debug("Codec probe: %s", error->message);
+        }
+        if (msg)
+            gst_message_unref(msg);
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+    return time;
+}
+
+
+/*
+ * Whether there is a decoder for the caps of a codec.
+ */
+static gboolean has_decoder(const CodecInfo * codec) {
+    GstCaps * caps = gst_caps_from_string(codec->caps);
+    GList * factories = gst_element_factory_list_get_elements(
+        GST_ELEMENT_FACTORY_TYPE_DECODER, GST_RANK_MARGINAL);
+    GList * decoders = gst_element_factory_list_filter(factories, caps, GST_PAD_SINK, FALSE);
+    gboolean result = decoders != NULL;
+
+    gst_plugin_feature_list_free(decoders);
+    gst_plugin_feature_list_free(factories);
+    gst_caps_unref(caps);
+    return result;
+}
+
+
+/*
+ * Measure how long it takes to decode the clip of a codec, in microseconds, or -1
+ * if there is no clip or it cannot be decoded. has_clip tells them apart.
+ */
+static gint64 measure_codec(const CodecInfo * codec, gboolean * has_clip) {
+    g_autofree gchar * path = g_strdup_printf(CLIP_PATH, codec->name);
+    gsize size = 0;
+    gint64 best = -1;
+    int i;
+
+    // The clip is empty when the build host could not encode it
+    *has_clip = g_resources_get_info(path, 0, &size, NULL, NULL) && size > 0;
+    if (!*has_clip) {
+        g_debug("Codec probe: no clip for %s", codec->name);
+        return -1;
+    }
+    for (i = 0; i < DECODE_RUNS; ++i) {
+        gint64 time = decode_clip(path);
+        if (time < 0) return -1;
+        if (best < 0 || time < best) best = time;
+    }
+    return best;
+}
+
+
+static gint compare_costs(gconstpointer a, gconstpointer b) {
+    gint64 ta = ((const CodecCost *)a)->time, tb = ((const CodecCost *)b)->time;
+    return ta < tb ? -1 : ta > tb;
+}
+
+
+static void codec_probe_thread(GTask * task, gpointer source_object,
+                               gpointer task_data, GCancellable * cancellable) {
+    g_autoptr(GArray) costs = g_array_new(FALSE, FALSE, sizeof(CodecCost));
+    g_autoptr(GArray) unmeasured = g_array_new(FALSE, FALSE, sizeof(gint));
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(codecs); ++i) {
+        if (g_task_return_error_if_cancelled(task))
+            return;
+        gboolean has_clip;
+        CodecCost cost = { codecs[i].type, measure_codec(&codecs[i], &has_clip) };
+        if (cost.time >= 0) {
+            g_message("Video codec %s decodes in %.2f ms per frame",
+                      codecs[i].name, cost.time / 1000.0 / CLIP_FRAMES);
+            g_array_append_val(costs, cost);
+        } else if (!has_clip && has_decoder(&codecs[i])) {
+            g_message("Video codec %s could not be measured", codecs[i].name);
+            g_array_append_val(unmeasured, codecs[i].type);
+        } else {
+            g_message("Video codec %s cannot be decoded", codecs[i].name);
+        }
+    }
+
+    g_array_sort(costs, compare_costs);
+    GArray * ranking = g_array_sized_new(FALSE, FALSE, sizeof(gint), G_N_ELEMENTS(codecs));
+    for (i = 0; i < costs->len; ++i)
+        g_array_append_val(ranking, g_array_index(costs, CodecCost, i).type);
+    // There is a decoder, but no clip to measure it
+    g_array_append_vals(ranking, unmeasured->data, unmeasured->len);
+    g_task_return_pointer(task, ranking, (GDestroyNotify)g_array_unref);
+}
+
+
+void codec_probe_run_async(GCancellable * cancellable,
+                           GAsyncReadyCallback callback, gpointer user_data) {
+    g_autoptr(GTask) task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, codec_probe_run_async);
+    g_task_run_in_thread(task, codec_probe_thread);
+}
+
+
+GArray * codec_probe_run_finish(GAsyncResult * result, GError ** error) {
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CODEC_PROBE_H
+#define _CODEC_PROBE_H
+
+#include <gio/gio.h>
+
+
+/*
+ * codec_probe_get_key
+ *
+ * Get a key that identifies the local GStreamer installation: its version and its
+ * plugins. A ranking is still valid while the key does not change.
+ */
+gchar * codec_probe_get_key(void);
+
+/*
+ * codec_probe_run_async
+ *
+ * Measure, in a separate thread, how fast the local GStreamer decoders decode the
+ * short pre-encoded clip of each video codec that Spice can stream. The clips are
+ * built into the client, so no encoder is needed.
+ */
+void codec_probe_run_async(GCancellable * cancellable,
+                           GAsyncReadyCallback callback, gpointer user_data);
+
+/*
+ * codec_probe_run_finish
+ *
+ * Get the result of the probe: an array of SpiceVideoCodecType values, from the
+ * cheapest to the most expensive codec to decode. Codecs with a decoder but no clip
+ * to measure it come last, and codecs that failed to decode are left out.
+ */
+GArray * codec_probe_run_finish(GAsyncResult * result, GError ** error);
+
+
+#endif /* _CODEC_PROBE_H */
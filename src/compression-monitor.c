@@ -0,0 +1,360 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include "compression-monitor.h"
+
+
+typedef struct MonitoredChannel {
+    SpiceChannel * channel;
+    gulong last_bytes;
+    gulong invalidate_handler;
+} MonitoredChannel;
+
+// Samples taken into account for a decision
+#define WINDOW_SAMPLES 10
+
+struct _CompressionMonitor {
+    GObject parent;
+    SpiceSession * session;
+    ClientScheduler * scheduler;
+    CompressionMonitorSocketFunc link_socket;
+    gpointer link_socket_data;
+    GList * channels;
+    guint sample_id;
+    gint64 last_sample;
+    gint compression;
+    // Rate of the last samples, in bytes per second, -1 for idle samples
+    gint64 rates[WINDOW_SAMPLES];
+    guint next_rate, num_rates;
+    guint hold;
+    // Consecutive samples with signs of saturation
+    guint saturated;
+    gint64 min_rtt;
+};
+
+// Time between samples, in seconds
+#define SAMPLE_INTERVAL 1
+// Samples with less data do not say much about the bandwidth, in bytes per second
+#define BUSY_RATE (64 * 1024)
+// Above this rate the link is fast, lz4 is cheaper than glz
+#define FAST_RATE (3 * 1024 * 1024)
+#define FAST_SAMPLES 2
+// A round trip time this many times the best one, plus a margin in us, is a sign
+// of saturation: the difference is spent in the queues of the path
+#define RTT_FACTOR 2
+#define RTT_MARGIN 20000
+// Without the round trip time, a display that is busy for a whole window with a
+// rate that does not vary more than this fraction of the peak: the link caps it
+#define PLATEAU_SPREAD 0.2
+// Saturated samples in a row to switch to glz/quic, which save bandwidth
+#define SATURATED_SAMPLES 3
+// Samples without switches after a switch
+#define HOLD_SAMPLES 30
+
+G_DEFINE_TYPE(CompressionMonitor, compression_monitor, G_TYPE_OBJECT);
+
+
+static void compression_monitor_dispose(GObject * obj);
+
+static void compression_monitor_class_init(CompressionMonitorClass * class) {
+    GObjectClass * object_class = G_OBJECT_CLASS(class);
+    object_class->dispose = compression_monitor_dispose;
+}
+
+
+static void compression_monitor_init(CompressionMonitor * monitor) {
+    monitor->compression = SPICE_IMAGE_COMPRESSION_INVALID;
+    monitor->min_rtt = -1;
+}
+
+
+static void free_monitored_channel(gpointer data) {
+    MonitoredChannel * mc = (MonitoredChannel *)data;
+    g_signal_handler_disconnect(mc->channel, mc->invalidate_handler);
+    g_object_unref(mc->channel);
+    g_free(mc);
+}
+
+
+static void stop_sampling(CompressionMonitor * monitor) {
+    if (!monitor->sample_id) return;
+    if (monitor->scheduler)
+        client_scheduler_remove(monitor->scheduler, monitor->sample_id);
+    else
+        g_source_remove(monitor->sample_id);
+    monitor->sample_id = 0;
+}
+
+
+static void compression_monitor_dispose(GObject * obj) {
+    CompressionMonitor * monitor = COMPRESSION_MONITOR(obj);
+    stop_sampling(monitor);
+    g_clear_object(&monitor->scheduler);
+    g_list_free_full(monitor->channels, free_monitored_channel);
+    monitor->channels = NULL;
+    G_OBJECT_CLASS(compression_monitor_parent_class)->dispose(obj);
+}
+
+
+CompressionMonitor * compression_monitor_new(SpiceSession * session, ClientScheduler * scheduler,
+        CompressionMonitorSocketFunc link_socket, gpointer user_data) {
+    CompressionMonitor * monitor =
+        COMPRESSION_MONITOR(g_object_new(COMPRESSION_MONITOR_TYPE, NULL));
+    monitor->session = session;
+    if (scheduler)
+        monitor->scheduler = g_object_ref(scheduler);
+    monitor->link_socket = link_socket;
+    monitor->link_socket_data = user_data;
+    return monitor;
+}
+
+
+static const gchar * compression_name(gint compression) {
+    switch (compression) {
+    case SPICE_IMAGE_COMPRESSION_AUTO_GLZ: return "auto-glz";
+    case SPICE_IMAGE_COMPRESSION_LZ4: return "lz4";
+    default: return "unknown";
+    }
+}
+
+
+static void set_compression(CompressionMonitor * monitor, gint compression) {
+    GList * l;
+    g_object_set(monitor->session, "preferred-compression", compression, NULL);
+    for (l = monitor->channels; l != NULL; l = l->next) {
+        SpiceChannel * channel = ((MonitoredChannel *)l->data)->channel;
+#if SPICE_GTK_CHECK_VERSION(0, 35, 0)
+        spice_display_channel_change_preferred_compression(channel, compression);
+#else
+        spice_display_change_preferred_compression(channel, compression);
+#endif
+    }
+}
+
+
+gint64 compression_monitor_get_socket_rtt(GSocket * socket) {
+    GSocketFamily family = g_socket_get_family(socket);
+    if (family != G_SOCKET_FAMILY_IPV4 && family != G_SOCKET_FAMILY_IPV6)
+        return -1;
+#ifdef __linux__
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(g_socket_get_fd(socket), IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        // A display channel mostly receives, the sender estimate may have no samples yet
+        guint32 rtt = info.tcpi_rtt ? info.tcpi_rtt : info.tcpi_rcv_rtt;
+        if (rtt > 0) return rtt;
+    }
+#elif defined(__APPLE__)
+    struct tcp_connection_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(g_socket_get_fd(socket), IPPROTO_TCP, TCP_CONNECTION_INFO, &info, &len) == 0 &&
+        info.tcpi_srtt > 0)
+        return (gint64)info.tcpi_srtt * 1000;
+#endif
+    return -1;
+}
+
+
+/*
+ * The worst round trip time of the links of the display channels.
+ */
+static gint64 get_link_rtt(CompressionMonitor * monitor) {
+    gint64 rtt = -1;
+    GList * l;
+
+    for (l = monitor->channels; l != NULL; l = l->next) {
+        SpiceChannel * channel = ((MonitoredChannel *)l->data)->channel;
+        GSocket * socket = NULL;
+        if (monitor->link_socket)
+            socket = monitor->link_socket(monitor->link_socket_data, channel);
+        else
+            g_object_get(channel, "socket", &socket, NULL);
+        if (socket) {
+            rtt = MAX(rtt, compression_monitor_get_socket_rtt(socket));
+            g_object_unref(socket);
+        }
+    }
+    return rtt;
+}
+
+
+static gboolean sample_timeout(gpointer user_data) {
+    CompressionMonitor * monitor = COMPRESSION_MONITOR(user_data);
+    gint64 now = g_get_monotonic_time(), bytes = 0;
+    GList * l;
+
+    for (l = monitor->channels; l != NULL; l = l->next) {
+        MonitoredChannel * mc = (MonitoredChannel *)l->data;
+        gulong total;
+        g_object_get(mc->channel, "total-read-bytes", &total, NULL);
+        bytes += total - mc->last_bytes;
+        mc->last_bytes = total;
+    }
+
+    gint64 interval = now - monitor->last_sample;
+    gint compression = compression_monitor_add_sample(monitor, bytes, interval,
+                                                      get_link_rtt(monitor));
+    monitor->last_sample = now;
+    if (compression != SPICE_IMAGE_COMPRESSION_INVALID)
+        set_compression(monitor, compression);
+
+    // Nothing to learn from an idle display, wait for the next update
+    if (interval > 0 && bytes * G_USEC_PER_SEC / interval < BUSY_RATE &&
+        monitor->saturated == 0) {
+        monitor->sample_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void start_sampling(CompressionMonitor * monitor) {
+    GList * l;
+    if (monitor->sample_id) return;
+    // Do not account for the traffic while sampling was stopped
+    for (l = monitor->channels; l != NULL; l = l->next) {
+        MonitoredChannel * mc = (MonitoredChannel *)l->data;
+        g_object_get(mc->channel, "total-read-bytes", &mc->last_bytes, NULL);
+    }
+    monitor->last_sample = g_get_monotonic_time();
+    if (monitor->scheduler)
+        monitor->sample_id = client_scheduler_add_seconds(monitor->scheduler, SAMPLE_INTERVAL,
+                                                          sample_timeout, monitor);
+    else
+        monitor->sample_id = g_timeout_add_seconds(SAMPLE_INTERVAL, sample_timeout, monitor);
+}
+
+
+static void display_invalidate(SpiceChannel * channel, gint x, gint y, gint w, gint h,
+                               gpointer user_data) {
+    start_sampling(COMPRESSION_MONITOR(user_data));
+}
+
+
+void compression_monitor_add_channel(CompressionMonitor * monitor, SpiceChannel * channel) {
+    MonitoredChannel * mc = g_new0(MonitoredChannel, 1);
+    mc->channel = g_object_ref(channel);
+    g_object_get(channel, "total-read-bytes", &mc->last_bytes, NULL);
+    mc->invalidate_handler = g_signal_connect(channel, "display-invalidate",
+                                              G_CALLBACK(display_invalidate), monitor);
+    monitor->channels = g_list_prepend(monitor->channels, mc);
+    start_sampling(monitor);
+}
+
+
+void compression_monitor_remove_channel(CompressionMonitor * monitor, SpiceChannel * channel) {
+    GList * l;
+    for (l = monitor->channels; l != NULL; l = l->next) {
+        MonitoredChannel * mc = (MonitoredChannel *)l->data;
+        if (mc->channel == channel) {
+            monitor->channels = g_list_delete_link(monitor->channels, l);
+            free_monitored_channel(mc);
+            break;
+        }
+    }
+    if (!monitor->channels)
+        stop_sampling(monitor);
+}
+
+
+/*
+ * Whether the throughput of a display that was busy for the whole window stays
+ * flat, below the fast rate.
+ */
+static gboolean is_plateau(CompressionMonitor * monitor) {
+    gint64 low = G_MAXINT64, high = 0;
+    guint i;
+
+    if (monitor->num_rates < WINDOW_SAMPLES) return FALSE;
+    for (i = 0; i < WINDOW_SAMPLES; ++i) {
+        if (monitor->rates[i] < 0) return FALSE;
+        low = MIN(low, monitor->rates[i]);
+        high = MAX(high, monitor->rates[i]);
+    }
+    return high < FAST_RATE && high - low <= high * PLATEAU_SPREAD;
+}
+
+
+/*
+ * Whether the link shows signs of saturation: the round trip time is well above
+ * the best one seen. Where the platform does not report it, the throughput is
+ * capped instead.
+ */
+static gboolean is_saturated(CompressionMonitor * monitor, gint64 rtt) {
+    if (rtt < 0)
+        return is_plateau(monitor);
+    if (monitor->min_rtt < 0 || rtt < monitor->min_rtt)
+        monitor->min_rtt = rtt;
+    return rtt > monitor->min_rtt * RTT_FACTOR + RTT_MARGIN;
+}
+
+
+gint compression_monitor_add_sample(CompressionMonitor * monitor, gint64 bytes, gint64 interval,
+                                    gint64 rtt) {
+    guint i, fast = 0;
+    gint64 peak = 0;
+
+    if (interval <= 0) return SPICE_IMAGE_COMPRESSION_INVALID;
+    gint64 rate = bytes * G_USEC_PER_SEC / interval;
+    monitor->rates[monitor->next_rate] = rate >= BUSY_RATE ? rate : -1;
+    monitor->next_rate = (monitor->next_rate + 1) % WINDOW_SAMPLES;
+    if (monitor->num_rates < WINDOW_SAMPLES) monitor->num_rates++;
+    monitor->saturated = is_saturated(monitor, rtt) ? monitor->saturated + 1 : 0;
+
+    if (monitor->hold) {
+        monitor->hold--;
+        return SPICE_IMAGE_COMPRESSION_INVALID;
+    }
+
+    for (i = 0; i < monitor->num_rates; ++i) {
+        if (monitor->rates[i] < 0) continue;
+        if (monitor->rates[i] >= FAST_RATE) fast++;
+        if (monitor->rates[i] > peak) peak = monitor->rates[i];
+    }
+
+    gint compression = SPICE_IMAGE_COMPRESSION_INVALID;
+    if (monitor->saturated >= SATURATED_SAMPLES)
+        compression = SPICE_IMAGE_COMPRESSION_AUTO_GLZ;
+    else if (fast >= FAST_SAMPLES)
+        compression = SPICE_IMAGE_COMPRESSION_LZ4;
+    if (compression == SPICE_IMAGE_COMPRESSION_INVALID || compression == monitor->compression)
+        return SPICE_IMAGE_COMPRESSION_INVALID;
+
+    if (compression == SPICE_IMAGE_COMPRESSION_AUTO_GLZ &&
+        rtt > monitor->min_rtt * RTT_FACTOR + RTT_MARGIN)
+        g_message("Switching image compression to %s, the link is saturated (RTT %.1f ms, best %.1f ms)",
+                  compression_name(compression), rtt / 1000.0, monitor->min_rtt / 1000.0);
+    else if (compression == SPICE_IMAGE_COMPRESSION_AUTO_GLZ)
+        g_message("Switching image compression to %s, display bandwidth is capped at %.1f Mbit/s",
+                  compression_name(compression), peak * 8.0 / 1000000);
+    else
+        g_message("Switching image compression to %s, display bandwidth peaked at %.1f Mbit/s",
+                  compression_name(compression), peak * 8.0 / 1000000);
+    monitor->compression = compression;
+    // Rates measured with the previous compression are not comparable
+    monitor->num_rates = monitor->next_rate = 0;
+    monitor->saturated = 0;
+    monitor->hold = HOLD_SAMPLES;
+    return compression;
+}
@@ -0,0 +1,98 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMPRESSION_MONITOR_H
+#define _COMPRESSION_MONITOR_H
+
+#include <glib-object.h>
+#include <spice-client.h>
+#include "client-scheduler.h"
+
+
+/*
+ * CompressionMonitor
+ *
+ * Watches the traffic of the display channels of a session, and switches the
+ * preferred image compression accordingly: lz4 when the link proves to be fast,
+ * like on a LAN, and auto-glz (glz or quic) when it shows signs of saturation.
+ * That is a smoothed TCP round trip time well above the best one seen, which
+ * means that packets wait in a queue along the path. Where the platform does not
+ * report the round trip time, it is a busy display whose throughput stays flat
+ * below the fast rate, which means that it is capped by the link. Low traffic
+ * alone only means that the screen does not change much, so it does not switch
+ * anything. To avoid flapping, a switch needs several samples and is followed by
+ * a period without switches. Sampling stops while the display is idle, and resumes
+ * with the next display update.
+ */
+#define COMPRESSION_MONITOR_TYPE (compression_monitor_get_type())
+G_DECLARE_FINAL_TYPE(CompressionMonitor, compression_monitor, COMPRESSION, MONITOR, GObject)
+
+/*
+ * Link socket callback: return a new reference to the TCP socket that carries the
+ * traffic of a channel to the server, or NULL if there is none yet. Through a
+ * WebSocket tunnel, the socket of the channel only reaches the local end of it.
+ */
+typedef GSocket * (* CompressionMonitorSocketFunc)(gpointer user_data, SpiceChannel * channel);
+
+/*
+ * compression_monitor_new
+ *
+ * Create a new monitor for the display channels of a session. Samples are taken
+ * with the scheduler, or a GLib timeout if it is NULL. link_socket finds the socket
+ * to measure the round trip time of each channel; if it is NULL, the socket of the
+ * channel itself is used. The session must outlive the monitor.
+ */
+CompressionMonitor * compression_monitor_new(SpiceSession * session, ClientScheduler * scheduler,
+    CompressionMonitorSocketFunc link_socket, gpointer user_data);
+
+/*
+ * compression_monitor_add_channel
+ *
+ * Start measuring the traffic of a display channel.
+ */
+void compression_monitor_add_channel(CompressionMonitor * monitor, SpiceChannel * channel);
+
+/*
+ * compression_monitor_remove_channel
+ *
+ * Stop measuring the traffic of a display channel, e.g. when it is destroyed.
+ */
+void compression_monitor_remove_channel(CompressionMonitor * monitor, SpiceChannel * channel);
+
+/*
+ * compression_monitor_add_sample
+ *
+ * Account for bytes received by the display channels during interval microseconds,
+ * with the round trip time of the link at the end of the interval, in microseconds
+ * or -1 if it is not known. Return the compression to switch to, or
+ * SPICE_IMAGE_COMPRESSION_INVALID to keep the current one. This is done
+ * periodically by the monitor itself.
+ */
+gint compression_monitor_add_sample(CompressionMonitor * monitor, gint64 bytes, gint64 interval,
+                                    gint64 rtt);
+
+/*
+ * compression_monitor_get_socket_rtt
+ *
+ * Get the smoothed round trip time that the kernel keeps for a TCP socket, in
+ * microseconds. Return -1 if it is not known, or the platform does not report it.
+ */
+gint64 compression_monitor_get_socket_rtt(GSocket * socket);
+
+#endif /* _COMPRESSION_MONITOR_H */
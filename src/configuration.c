@@ -18,6 +18,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "configuration.h"
 #include "client-log.h"
 
@@ -30,6 +31,7 @@ struct _ClientConf {
     gchar * file_name;
     gboolean had_file;
     SoupSession * soup;
+    SoupSession * long_poll_soup;
     // Main options
     gchar * host;
     gchar * port;
@@ -39,11 +41,17 @@ struct _ClientConf {
     gchar * terminal_id;
     gchar * uri;
     gboolean kiosk_mode;
+    gboolean startup_trace;
+    gchar * timeline_file;
     // Session options
     gchar * desktop;
     gchar * proxy_uri;
     gboolean fullscreen;
     gint inactivity_timeout;
+    gint desktop_poll_timeout;
+    gint desktop_long_poll;
+    gint reconnect_timeout;
+    gchar * active_endpoint;
     gboolean disable_printing;
     gboolean auto_clipboard;
     gboolean auto_usbredir;
@@ -54,6 +62,7 @@ struct _ClientConf {
     gboolean disable_power_actions;
     gboolean disable_usbredir;
     gchar * preferred_compression;
+    gchar * preferred_video_codecs;
     gchar * grab_sequence;
     gchar * shared_folder;
     gboolean shared_folder_ro;
@@ -62,9 +71,34 @@ struct _ClientConf {
     gchar * usb_auto_filter;
     gchar * usb_connect_filter;
     gchar ** serial_params;
+    gint serial_buffer_size;
+    gint serial_latency;
+    gboolean serial_low_latency;
+    gint serial_vmin;
+    gint serial_vtime;
     gchar ** printers;
+    // Pending changes, see client_conf_changed
+    gboolean dirty;
+    gint64 last_change;
+    guint save_id;
+    GHashTable * layouts;
 };
 
+
+/*
+ * The size of a window, kept apart from the key file so that it is only formatted
+ * when the configuration is saved.
+ */
+typedef struct WindowLayout {
+    int width, height;
+    gboolean maximized;
+    int monitor;
+    gboolean dirty;
+} WindowLayout;
+
+// Changes are saved to disk this long after the last one, in ms
+#define SAVE_DELAY 1000
+
 G_DEFINE_TYPE(ClientConf, client_conf, G_TYPE_OBJECT);
 
 
@@ -77,6 +111,7 @@ static void client_conf_class_init(ClientConfClass * class) {
 
 
 static void client_conf_load(ClientConf * conf);
+static void client_conf_changed(ClientConf * conf);
 static gboolean set_proxy_uri(const gchar * option_name, const gchar * value, gpointer data, GError ** error);
 static gboolean set_toolbar_edge(const gchar * option_name, const gchar * value, gpointer data, GError ** error);
 static gboolean set_log_level(const gchar * option_name, const gchar * value, gpointer data, GError ** error);
@@ -87,7 +122,7 @@ static void client_conf_init(ClientConf * conf) {
     GOptionEntry main_options[] = {
         // { long_name, short_name, flags, arg, arg_data, description, arg_description },
         { "host", 'h', 0, G_OPTION_ARG_STRING, &conf->host,
-        "Connection host address", "<hostname or IP>" },
+        "Connection host address, or a comma-separated list of manager hosts to fail over", "<hostname or IP>[:port],..." },
         { "port", 'p', 0, G_OPTION_ARG_STRING, &conf->port,
         "Connection port (default 443)", "<port number>" },
         { "proxy-uri", 0, 0, G_OPTION_ARG_CALLBACK, set_proxy_uri,
@@ -117,6 +152,12 @@ static void client_conf_init(ClientConf * conf) {
         G_OPTION_ARG_NONE, &conf->fullscreen, "", NULL },
         { "inactivity-timeout", 0, 0, G_OPTION_ARG_INT, &conf->inactivity_timeout,
         "Close the client after a certain time of inactivity", "<seconds>" },
+        { "desktop-poll-timeout", 0, 0, G_OPTION_ARG_INT, &conf->desktop_poll_timeout,
+        "Stop waiting for a desktop that is being prepared after a certain time (default 300, 0 = never)", "<seconds>" },
+        { "desktop-long-poll", 0, 0, G_OPTION_ARG_INT, &conf->desktop_long_poll,
+        "Ask the manager to hold desktop requests until the desktop is ready, up to a certain time", "<seconds>" },
+        { "reconnect-timeout", 0, 0, G_OPTION_ARG_INT, &conf->reconnect_timeout,
+        "Try to restore a lost connection for a certain time before closing it (default 60, 0 = never)", "<seconds>" },
         { "flexvdi-disable-printing", 0, 0, G_OPTION_ARG_NONE, &conf->disable_printing,
         "Disable printing support", NULL },
         { "auto-clipboard", 0, 0, G_OPTION_ARG_NONE, &conf->auto_clipboard,
@@ -142,7 +183,11 @@ static void client_conf_init(ClientConf * conf) {
         { "disable-usbredir", 0, 0, G_OPTION_ARG_NONE, &conf->disable_usbredir,
         "Disable USB device redirection", NULL },
         { "preferred-compression", 0, 0, G_OPTION_ARG_STRING, &conf->preferred_compression,
-        "Preferred image compression algorithm", "<auto-glz,auto-lz,quic,glz,lz,lz4,off>" },
+        "Preferred image compression algorithm, or adaptive to choose it from the link",
+        "<adaptive,auto-glz,auto-lz,quic,glz,lz,lz4,off>" },
+        { "preferred-video-codecs", 0, 0, G_OPTION_ARG_STRING, &conf->preferred_video_codecs,
+        "Preferred video codecs, in order, or probe the fastest decoders by default",
+        "<probe,off,codec[,codec...]> with codecs mjpeg,vp8,vp9,h264,h265" },
         { "shared-folder", 0, 0, G_OPTION_ARG_STRING, &conf->shared_folder,
         "Shared directory with the guest", NULL },
         { "shared-folder-ro", 0, 0, G_OPTION_ARG_NONE, &conf->shared_folder_ro,
@@ -161,6 +206,16 @@ static void client_conf_init(ClientConf * conf) {
         { "flexvdi-serial-port", 0, 0, G_OPTION_ARG_STRING_ARRAY, &conf->serial_params,
         "Add serial port redirection. Can appear multiple times. "
         "Example: /dev/ttyS0,9600,8N1", "<device,speed,mode>" },
+        { "flexvdi-serial-buffer", 0, 0, G_OPTION_ARG_INT, &conf->serial_buffer_size,
+        "Maximum amount of serial port data sent to the guest at once (default 4096)", "<bytes>" },
+        { "flexvdi-serial-latency", 0, 0, G_OPTION_ARG_INT, &conf->serial_latency,
+        "Time to gather serial port data before sending it to the guest (default 5)", "<milliseconds>" },
+        { "flexvdi-serial-low-latency", 0, 0, G_OPTION_ARG_NONE, &conf->serial_low_latency,
+        "Read serial ports in a dedicated thread, favouring latency over throughput", NULL },
+        { "flexvdi-serial-vmin", 0, 0, G_OPTION_ARG_INT, &conf->serial_vmin,
+        "Minimum number of characters of a serial port read in low latency mode (default 1)", "<characters>" },
+        { "flexvdi-serial-vtime", 0, 0, G_OPTION_ARG_INT, &conf->serial_vtime,
+        "Serial port read timeout in low latency mode (default 5)", "<tenths of second>" },
         { "share-printer", 'P', 0, G_OPTION_ARG_STRING_ARRAY, &conf->printers,
         "Share a client's printer with the virtual desktop. Can appear multiple times",
         "<printer_name>" },
@@ -173,6 +228,12 @@ static void client_conf_init(ClientConf * conf) {
     conf->grab_mouse = TRUE;
     conf->grab_sequence = g_strdup("Shift_L+F12");
     conf->resize_guest = TRUE;
+    conf->desktop_poll_timeout = 300;
+    conf->reconnect_timeout = 60;
+    conf->serial_buffer_size = 4096;
+    conf->serial_latency = 5;
+    conf->serial_vmin = 1;
+    conf->serial_vtime = 5;
     conf->main_options = g_memdup(main_options, sizeof(main_options));
     conf->session_options = g_memdup(session_options, sizeof(session_options));
     conf->device_options = g_memdup(device_options, sizeof(device_options));
@@ -190,6 +251,7 @@ static void client_conf_init(ClientConf * conf) {
 #endif
     conf->cmdline_options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
     conf->file = g_key_file_new();
+    conf->layouts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
     conf->file_name = g_build_filename(
         g_get_user_config_dir(),
         "flexvdi-client",
@@ -197,22 +259,29 @@ static void client_conf_init(ClientConf * conf) {
         NULL
     );
     // FIXME: Disable checking server certificate
+    // Idle connections are kept for a while, see client_conf_warm_up_connection
     conf->soup = soup_session_new_with_options(
         "ssl-strict", FALSE,
         "timeout", 5,
+        "idle-timeout", 90,
         NULL);
 }
 
 
 static void client_conf_finalize(GObject * obj) {
     ClientConf * conf = CLIENT_CONF(obj);
+    // Do not lose pending changes
+    client_conf_save(conf);
+    g_hash_table_unref(conf->layouts);
     g_free(conf->file_name);
+    g_free(conf->timeline_file);
     g_free(conf->main_options);
     g_free(conf->session_options);
     g_free(conf->device_options);
     g_free(conf->all_options);
     g_free(conf->host);
     g_free(conf->port);
+    g_free(conf->active_endpoint);
     g_free(conf->username);
     g_free(conf->password);
     g_free(conf->passfile);
@@ -222,12 +291,14 @@ static void client_conf_finalize(GObject * obj) {
     g_free(conf->usb_auto_filter);
     g_free(conf->usb_connect_filter);
     g_free(conf->preferred_compression);
+    g_free(conf->preferred_video_codecs);
     g_free(conf->terminal_id);
     g_free(conf->shared_folder);
     g_strfreev(conf->printers);
     g_key_file_free(conf->file);
     g_hash_table_unref(conf->cmdline_options);
     g_strfreev(conf->arguments);
+    g_clear_object(&conf->long_poll_soup);
     G_OBJECT_CLASS(client_conf_parent_class)->finalize(obj);
 }
 
@@ -306,6 +377,7 @@ static gint client_conf_handle_options(GApplication * gapp, GVariantDict * opts,
         g_debug("Command line option '%s' = '%s'", (gchar *)key, (gchar *)value);
 
     client_conf_load(conf);
+    client_log_startup_mark("config load");
 
     return -1;
 }
@@ -341,6 +413,10 @@ void client_conf_set_application_options(ClientConf * conf, GApplication * app)
         "Show version and exit", NULL },
         { "config-file", 'c', 0, G_OPTION_ARG_STRING, &conf->file_name,
         "Alternative configuration file name", "<file name>" },
+        { "startup-trace", 0, 0, G_OPTION_ARG_NONE, &conf->startup_trace,
+        "Print how long each startup phase takes", NULL },
+        { "timeline-file", 0, 0, G_OPTION_ARG_FILENAME, &conf->timeline_file,
+        "Save the connection timeline to a file, in Chrome trace format", "<file name>" },
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
     };
     g_application_add_main_option_entries(app, conf->main_options);
@@ -370,7 +446,10 @@ gboolean client_conf_had_file(ClientConf * conf) {
  */
 static void parse_preferred_compression(SpiceSession * session, const gchar * value) {
     int preferred_compression = SPICE_IMAGE_COMPRESSION_INVALID;
-    if (!g_strcmp0(value, "auto-glz")) {
+    if (!g_strcmp0(value, "adaptive")) {
+        // Chosen during the session, see client_conf_get_adaptive_compression
+        return;
+    } else if (!g_strcmp0(value, "auto-glz")) {
         preferred_compression = SPICE_IMAGE_COMPRESSION_AUTO_GLZ;
     } else if (!g_strcmp0(value, "auto-lz")) {
         preferred_compression = SPICE_IMAGE_COMPRESSION_AUTO_LZ;
@@ -481,17 +560,129 @@ const gchar * client_conf_get_proxy_uri(ClientConf * conf) {
 }
 
 
+gboolean client_conf_get_startup_trace(ClientConf * conf) {
+    return conf->startup_trace;
+}
+
+
+const gchar * client_conf_get_timeline_file(ClientConf * conf) {
+    return conf->timeline_file;
+}
+
+
+gboolean client_conf_get_adaptive_compression(ClientConf * conf) {
+    return !g_strcmp0(conf->preferred_compression, "adaptive");
+}
+
+
+GArray * client_conf_get_preferred_video_codecs(ClientConf * conf) {
+    static const struct {
+        const gchar * name;
+        gint type;
+    } names[] = {
+        { "mjpeg", SPICE_VIDEO_CODEC_TYPE_MJPEG },
+        { "vp8", SPICE_VIDEO_CODEC_TYPE_VP8 },
+        { "vp9", SPICE_VIDEO_CODEC_TYPE_VP9 },
+        { "h264", SPICE_VIDEO_CODEC_TYPE_H264 },
+        { "h265", SPICE_VIDEO_CODEC_TYPE_H265 },
+    };
+    const gchar * value = conf->preferred_video_codecs;
+    int i, j;
+
+    if (!value || !g_strcmp0(value, "probe"))
+        return NULL;
+    GArray * codecs = g_array_new(FALSE, FALSE, sizeof(gint));
+    if (!g_strcmp0(value, "off"))
+        return codecs;
+    g_auto(GStrv) codec_names = g_strsplit(value, ",", 0);
+    for (i = 0; codec_names[i]; ++i) {
+        g_strstrip(codec_names[i]);
+        for (j = 0; j < G_N_ELEMENTS(names); ++j)
+            if (!g_ascii_strcasecmp(codec_names[i], names[j].name)) break;
+        if (j < G_N_ELEMENTS(names))
+            g_array_append_val(codecs, names[j].type);
+        else
+            g_warning("Video codec %s not supported", codec_names[i]);
+    }
+    return codecs;
+}
+
+
+GArray * client_conf_get_video_codec_ranking(ClientConf * conf, const gchar * key) {
+    g_autofree gchar * saved_key = g_key_file_get_string(conf->file, "VideoCodecs", "key", NULL);
+    g_autofree gint * ranking = NULL;
+    gsize length = 0;
+
+    if (g_strcmp0(saved_key, key)) return NULL;
+    ranking = g_key_file_get_integer_list(conf->file, "VideoCodecs", "ranking", &length, NULL);
+    if (!ranking) return NULL;
+    GArray * codecs = g_array_sized_new(FALSE, FALSE, sizeof(gint), length);
+    g_array_append_vals(codecs, ranking, length);
+    return codecs;
+}
+
+
+void client_conf_set_video_codec_ranking(ClientConf * conf, const gchar * key, GArray * ranking) {
+    g_key_file_set_string(conf->file, "VideoCodecs", "key", key);
+    g_key_file_set_integer_list(conf->file, "VideoCodecs", "ranking",
+                                (gint *)ranking->data, ranking->len);
+    client_conf_changed(conf);
+}
+
+
 gboolean client_conf_get_kiosk_mode(ClientConf * conf) {
     return conf->kiosk_mode;
 }
 
 
 gchar * client_conf_get_connection_uri(ClientConf * conf, const gchar * path) {
+    if (conf->active_endpoint)
+        return g_strconcat(conf->active_endpoint, path, NULL);
+    g_auto(GStrv) endpoints = client_conf_get_manager_endpoints(conf);
+    if (!endpoints || !endpoints[0]) return NULL;
+    return g_strconcat(endpoints[0], path, NULL);
+}
+
+
+gchar ** client_conf_get_manager_endpoints(ClientConf * conf) {
     if (!conf->host) return NULL;
-    if (!conf->port || !g_strcmp0(conf->port, ""))
-        return g_strdup_printf("https://%s%s", conf->host, path);
-    else
-        return g_strdup_printf("https://%s:%s%s", conf->host, conf->port, path);
+    g_auto(GStrv) hosts = g_strsplit(conf->host, ",", 0);
+    GPtrArray * endpoints = g_ptr_array_new();
+    gchar ** host;
+    gboolean default_port = !conf->port || !g_strcmp0(conf->port, "");
+    for (host = hosts; *host; ++host) {
+        g_strstrip(*host);
+        if (**host == '\0') continue;
+        if (strpbrk(*host, "/?#@ ")) {
+            g_warning("Invalid manager host %s", *host);
+            continue;
+        }
+        const gchar * colon = strrchr(*host, ':'), * bracket = strrchr(*host, ']');
+        if (bracket) {
+            // IPv6 address in brackets, maybe with a port
+            gboolean has_port = colon && colon > bracket;
+            g_ptr_array_add(endpoints, has_port || default_port ?
+                g_strdup_printf("https://%s", *host) :
+                g_strdup_printf("https://%s:%s", *host, conf->port));
+        } else if (colon && colon != strchr(*host, ':')) {
+            // Bare IPv6 address
+            g_ptr_array_add(endpoints, default_port ?
+                g_strdup_printf("https://[%s]", *host) :
+                g_strdup_printf("https://[%s]:%s", *host, conf->port));
+        } else {
+            g_ptr_array_add(endpoints, colon || default_port ?
+                g_strdup_printf("https://%s", *host) :
+                g_strdup_printf("https://%s:%s", *host, conf->port));
+        }
+    }
+    g_ptr_array_add(endpoints, NULL);
+    return (gchar **)g_ptr_array_free(endpoints, FALSE);
+}
+
+
+void client_conf_set_active_endpoint(ClientConf * conf, const gchar * endpoint) {
+    g_free(conf->active_endpoint);
+    conf->active_endpoint = g_strdup(endpoint);
 }
 
 
@@ -505,6 +696,31 @@ gchar ** client_conf_get_serial_params(ClientConf * conf) {
 }
 
 
+gint client_conf_get_serial_buffer_size(ClientConf * conf) {
+    return conf->serial_buffer_size > 0 ? conf->serial_buffer_size : 1;
+}
+
+
+gint client_conf_get_serial_latency(ClientConf * conf) {
+    return conf->serial_latency > 0 ? conf->serial_latency : 0;
+}
+
+
+gboolean client_conf_get_serial_low_latency(ClientConf * conf) {
+    return conf->serial_low_latency;
+}
+
+
+gint client_conf_get_serial_vmin(ClientConf * conf) {
+    return CLAMP(conf->serial_vmin, 0, 255);
+}
+
+
+gint client_conf_get_serial_vtime(ClientConf * conf) {
+    return CLAMP(conf->serial_vtime, 0, 255);
+}
+
+
 gboolean client_conf_get_disable_printing(ClientConf * conf) {
     return conf->disable_printing;
 }
@@ -540,6 +756,21 @@ gint client_conf_get_inactivity_timeout(ClientConf * conf) {
 }
 
 
+gint client_conf_get_desktop_poll_timeout(ClientConf * conf) {
+    return conf->desktop_poll_timeout > 0 ? conf->desktop_poll_timeout : 0;
+}
+
+
+gint client_conf_get_desktop_long_poll(ClientConf * conf) {
+    return conf->desktop_long_poll > 0 ? conf->desktop_long_poll : 0;
+}
+
+
+gint client_conf_get_reconnect_timeout(ClientConf * conf) {
+    return conf->reconnect_timeout > 0 ? conf->reconnect_timeout : 0;
+}
+
+
 gboolean client_conf_get_auto_clipboard(ClientConf * conf) {
     return conf->auto_clipboard;
 }
@@ -550,6 +781,59 @@ SoupSession * client_conf_get_soup_session(ClientConf * conf) {
 }
 
 
+SoupSession * client_conf_get_long_poll_soup_session(ClientConf * conf) {
+    if (conf->desktop_long_poll <= 0)
+        return conf->soup;
+    if (!conf->long_poll_soup) {
+        // Long-polled requests must not time out before the manager answers
+        g_autoptr(SoupURI) proxy_uri = NULL;
+        g_object_get(conf->soup, "proxy-uri", &proxy_uri, NULL);
+        conf->long_poll_soup = soup_session_new_with_options(
+            "ssl-strict", FALSE,
+            "timeout", conf->desktop_long_poll + 5,
+            "idle-timeout", 90,
+            "proxy-uri", proxy_uri,
+            NULL);
+    }
+    return conf->long_poll_soup;
+}
+
+
+void client_conf_prefetch_dns(ClientConf * conf) {
+    g_auto(GStrv) endpoints = client_conf_get_manager_endpoints(conf);
+    gchar ** endpoint;
+    for (endpoint = endpoints; endpoint && *endpoint; ++endpoint) {
+        SoupURI * uri = soup_uri_new(*endpoint);
+        if (uri) {
+            soup_session_prefetch_dns(conf->soup, soup_uri_get_host(uri), NULL, NULL, NULL);
+            soup_uri_free(uri);
+        }
+    }
+}
+
+
+static void warm_up_finished_cb(GObject * object, GAsyncResult * result, gpointer user_data) {
+    SoupMessage * msg = SOUP_MESSAGE(user_data);
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GInputStream) stream = soup_session_send_finish(SOUP_SESSION(object), result, &error);
+    if (stream) {
+        g_debug("Connection to the manager is ready (status %u)", msg->status_code);
+        g_input_stream_close(stream, NULL, NULL);
+    } else {
+        g_debug("Could not warm up the connection to the manager: %s", error->message);
+    }
+    g_object_unref(msg);
+}
+
+
+void client_conf_warm_up_connection(ClientConf * conf) {
+    g_autofree gchar * uri = client_conf_get_connection_uri(conf, "/");
+    SoupMessage * msg = uri ? soup_message_new("HEAD", uri) : NULL;
+    if (msg)
+        soup_session_send_async(conf->soup, msg, NULL, warm_up_finished_cb, msg);
+}
+
+
 WindowEdge client_conf_get_toolbar_edge(ClientConf * conf) {
     return conf->toolbar_edge;
 }
@@ -606,6 +890,34 @@ static void write_int(GKeyFile * file, const gchar * group, const gchar * key, g
 }
 
 
+static gboolean save_timeout(gpointer user_data) {
+    ClientConf * conf = CLIENT_CONF(user_data);
+    gint64 remaining = conf->last_change + SAVE_DELAY * 1000 - g_get_monotonic_time();
+    if (remaining > 0) {
+        // There were more changes, wait until they settle
+        conf->save_id = g_timeout_add(remaining / 1000 + 1, save_timeout, conf);
+    } else {
+        conf->save_id = 0;
+        client_conf_save(conf);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * client_conf_changed
+ *
+ * Mark the configuration as changed, and save it SAVE_DELAY ms after the last change.
+ * Bursts of changes, like window resizing, result in a single write to disk.
+ */
+static void client_conf_changed(ClientConf * conf) {
+    conf->dirty = TRUE;
+    conf->last_change = g_get_monotonic_time();
+    if (!conf->save_id)
+        conf->save_id = g_timeout_add(SAVE_DELAY, save_timeout, conf);
+}
+
+
 /*
  * discover_terminal_id
  *
@@ -621,6 +933,7 @@ const gchar * client_conf_get_terminal_id(ClientConf * conf) {
             conf->terminal_id = g_uuid_string_random();
         }
         write_string(conf->file, "General", "terminal-id", conf->terminal_id);
+        client_conf_changed(conf);
         client_conf_save(conf);
     }
     return conf->terminal_id;
@@ -629,19 +942,25 @@ const gchar * client_conf_get_terminal_id(ClientConf * conf) {
 
 void client_conf_set_host(ClientConf * conf, const gchar * host) {
     if (conf->kiosk_mode) return;
+    if (!g_strcmp0(conf->host, host)) return;
 
     g_free(conf->host);
     conf->host = g_strdup(host);
+    g_clear_pointer(&conf->active_endpoint, g_free);
     write_string(conf->file, "General", "host", conf->host);
+    client_conf_changed(conf);
 }
 
 
 void client_conf_set_port(ClientConf * conf, const gchar * port) {
     if (conf->kiosk_mode) return;
+    if (!g_strcmp0(conf->port, (port && port[0]) ? port : NULL)) return;
 
     g_free(conf->port);
     conf->port = (port && port[0]) ? g_strdup(port) : NULL;
+    g_clear_pointer(&conf->active_endpoint, g_free);
     write_string(conf->file, "General", "port", conf->port);
+    client_conf_changed(conf);
 }
 
 
@@ -652,6 +971,7 @@ void client_conf_set_username(ClientConf * conf, const gchar * username) {
     g_free(conf->username);
     conf->username = g_strdup(username);
     write_string(conf->file, "General", "username", conf->username);
+    client_conf_changed(conf);
 }
 
 
@@ -668,6 +988,7 @@ void client_conf_set_fullscreen(ClientConf * conf, gboolean fs) {
 
     conf->fullscreen = fs;
     write_bool(conf->file, "Session", "fullscreen", conf->fullscreen);
+    client_conf_changed(conf);
 }
 
 
@@ -680,11 +1001,15 @@ static gboolean set_proxy_uri(const gchar * option_name, const gchar * value, gp
         SoupURI * uri = soup_uri_new(conf->proxy_uri);
         if (uri) {
             g_object_set(conf->soup, "proxy-uri", uri, NULL);
+            if (conf->long_poll_soup)
+                g_object_set(conf->long_poll_soup, "proxy-uri", uri, NULL);
         } else {
             g_warning("Invalid proxy uri %s", conf->proxy_uri);
         }
     } else {
         g_object_set(conf->soup, "proxy-uri", NULL, NULL);
+        if (conf->long_poll_soup)
+            g_object_set(conf->long_poll_soup, "proxy-uri", NULL, NULL);
     }
 
     return TRUE;
@@ -697,6 +1022,7 @@ void client_conf_set_proxy_uri(ClientConf * conf, const gchar * proxy_uri) {
 
     set_proxy_uri("", proxy_uri, conf, NULL);
     write_string(conf->file, "General", "proxy-uri", conf->proxy_uri);
+    client_conf_changed(conf);
 }
 
 
@@ -734,7 +1060,7 @@ void client_conf_share_printer(ClientConf * conf, const gchar * printer, gboolea
     gchar ** sel_printer = conf->printers;
     while (*sel_printer && g_strcmp0(*sel_printer, printer)) ++sel_printer;
 
-    if (share && sel_printer == NULL) {
+    if (share && *sel_printer == NULL) {
         int i = g_strv_length(conf->printers);
         gchar ** new_printers = g_malloc_n(i + 2, sizeof(gchar *));
         new_printers[i + 1] = NULL;
@@ -745,11 +1071,15 @@ void client_conf_share_printer(ClientConf * conf, const gchar * printer, gboolea
         }
         g_strfreev(conf->printers);
         conf->printers = new_printers;
-    } else if (!share && sel_printer != NULL) {
+    } else if (!share && *sel_printer != NULL) {
         g_free(*sel_printer);
-        while (*sel_printer != NULL)
+        do {
             *sel_printer = *(sel_printer + 1);
-    }
+        } while (*(sel_printer++) != NULL);
+    } else return;
+
+    write_string_array(conf->file, "Devices", "share-printer", conf->printers);
+    client_conf_changed(conf);
 }
 
 
@@ -757,10 +1087,41 @@ void client_conf_set_window_size(ClientConf * conf, gint id, int width,
                                  int height, gboolean maximized, int monitor) {
     if (conf->kiosk_mode) return;
 
-    g_autofree gchar * encoded_size = g_strdup_printf("%d,%d,%s,%d",
-        width, height, maximized ? "true" : "false", monitor);
-    g_autofree gchar * id_str = g_strdup_printf("%d", id);
-    write_string(conf->file, "Layout", id_str, encoded_size);
+    WindowLayout * layout = g_hash_table_lookup(conf->layouts, GINT_TO_POINTER(id));
+    if (!layout) {
+        layout = g_new0(WindowLayout, 1);
+        g_hash_table_insert(conf->layouts, GINT_TO_POINTER(id), layout);
+    } else if (layout->width == width && layout->height == height &&
+               layout->maximized == maximized && layout->monitor == monitor) {
+        return;
+    }
+    layout->width = width;
+    layout->height = height;
+    layout->maximized = maximized;
+    layout->monitor = monitor;
+    layout->dirty = TRUE;
+    client_conf_changed(conf);
+}
+
+
+/*
+ * write_window_layouts
+ *
+ * Write the window sizes that changed to the key file.
+ */
+static void write_window_layouts(ClientConf * conf) {
+    GHashTableIter it;
+    gpointer id;
+    WindowLayout * layout;
+    g_hash_table_iter_init(&it, conf->layouts);
+    while (g_hash_table_iter_next(&it, &id, (gpointer *)&layout)) {
+        if (!layout->dirty) continue;
+        g_autofree gchar * encoded_size = g_strdup_printf("%d,%d,%s,%d",
+            layout->width, layout->height, layout->maximized ? "true" : "false", layout->monitor);
+        g_autofree gchar * id_str = g_strdup_printf("%d", GPOINTER_TO_INT(id));
+        write_string(conf->file, "Layout", id_str, encoded_size);
+        layout->dirty = FALSE;
+    }
 }
 
 
@@ -827,6 +1188,15 @@ static void read_int(GKeyFile * file, const gchar * group, const gchar * key, gi
 
 gboolean client_conf_get_window_size(ClientConf * conf, gint id,
     int * width, int * height, gboolean * maximized, int * monitor) {
+    WindowLayout * layout = g_hash_table_lookup(conf->layouts, GINT_TO_POINTER(id));
+    if (layout) {
+        *width = layout->width;
+        *height = layout->height;
+        *maximized = layout->maximized;
+        *monitor = layout->monitor;
+        return TRUE;
+    }
+
     g_autofree gchar * encoded_size = NULL;
     g_autofree gchar * id_str = g_strdup_printf("%d", id);
     read_string(conf->file, "Layout", id_str, &encoded_size);
@@ -856,8 +1226,11 @@ static void client_conf_load(ClientConf * conf) {
     int i;
     gchar * cb_arg;
 
-    if (!g_file_test(conf->file_name, G_FILE_TEST_EXISTS))
+    // Only the first run needs it, the settings file exists afterwards
+    if (!g_file_test(conf->file_name, G_FILE_TEST_EXISTS)) {
         try_migrate_legacy_config_file(conf->file_name);
+        client_log_startup_mark("legacy config migration");
+    }
 
     if (!g_key_file_load_from_file(conf->file, conf->file_name,
             G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS, &error)) {
@@ -950,6 +1323,14 @@ static void save_config_file(GKeyFile * file, const gchar * file_name, GError **
 
 
 void client_conf_save(ClientConf * conf) {
+    if (conf->save_id) {
+        g_source_remove(conf->save_id);
+        conf->save_id = 0;
+    }
+    write_window_layouts(conf);
+    if (!conf->dirty) return;
+    conf->dirty = FALSE;
+
 #ifdef ANDROID
     return;
 #endif
@@ -120,9 +120,18 @@ const gchar * client_conf_get_desktop(ClientConf * conf);
 const gchar * client_conf_get_uri(ClientConf * conf);
 const gchar * client_conf_get_proxy_uri(ClientConf * conf);
 gboolean client_conf_get_kiosk_mode(ClientConf * conf);
+gboolean client_conf_get_startup_trace(ClientConf * conf);
+const gchar * client_conf_get_timeline_file(ClientConf * conf);
+gboolean client_conf_get_adaptive_compression(ClientConf * conf);
 gchar * client_conf_get_connection_uri(ClientConf * conf, const gchar * path);
+gchar ** client_conf_get_manager_endpoints(ClientConf * conf);
 gboolean client_conf_get_fullscreen(ClientConf * conf);
 gchar ** client_conf_get_serial_params(ClientConf * conf);
+gint client_conf_get_serial_buffer_size(ClientConf * conf);
+gint client_conf_get_serial_latency(ClientConf * conf);
+gboolean client_conf_get_serial_low_latency(ClientConf * conf);
+gint client_conf_get_serial_vmin(ClientConf * conf);
+gint client_conf_get_serial_vtime(ClientConf * conf);
 gboolean client_conf_get_disable_printing(ClientConf * conf);
 const gchar * client_conf_get_terminal_id(ClientConf * conf);
 gboolean client_conf_get_disable_copy_from_guest(ClientConf * conf);
@@ -131,10 +140,65 @@ gboolean client_conf_get_disable_power_actions(ClientConf * conf);
 gboolean client_conf_is_printer_shared(ClientConf * conf, const gchar * printer);
 gchar * client_conf_get_grab_sequence(ClientConf * conf);
 gint client_conf_get_inactivity_timeout(ClientConf * conf);
+gint client_conf_get_desktop_poll_timeout(ClientConf * conf);
+gint client_conf_get_desktop_long_poll(ClientConf * conf);
+gint client_conf_get_reconnect_timeout(ClientConf * conf);
 gboolean client_conf_get_auto_clipboard(ClientConf * conf);
 SoupSession * client_conf_get_soup_session(ClientConf * conf);
+// A session with a timeout that fits desktop-long-poll, or the shared one without it
+SoupSession * client_conf_get_long_poll_soup_session(ClientConf * conf);
 WindowEdge client_conf_get_toolbar_edge(ClientConf * conf);
 
+/*
+ * client_conf_get_preferred_video_codecs
+ *
+ * Get the video codecs set with the preferred-video-codecs option, as an array of
+ * SpiceVideoCodecType values, most preferred first. An empty array means that no
+ * preference must be sent, and NULL that it must be found by probing the decoders.
+ */
+GArray * client_conf_get_preferred_video_codecs(ClientConf * conf);
+
+/*
+ * client_conf_get_video_codec_ranking
+ *
+ * Get the video codecs ranking saved by the last probe of the decoders, or NULL if
+ * there is none or it was saved with a different key.
+ */
+GArray * client_conf_get_video_codec_ranking(ClientConf * conf, const gchar * key);
+
+/*
+ * client_conf_set_video_codec_ranking
+ *
+ * Save the result of probing the decoders, so that it is not probed again while
+ * key does not change.
+ */
+void client_conf_set_video_codec_ranking(ClientConf * conf, const gchar * key, GArray * ranking);
+
+/*
+ * client_conf_set_active_endpoint
+ *
+ * Set the manager endpoint (one of client_conf_get_manager_endpoints) that
+ * client_conf_get_connection_uri uses, e.g. the fastest one. It is reset when the
+ * host or port change.
+ */
+void client_conf_set_active_endpoint(ClientConf * conf, const gchar * endpoint);
+
+/*
+ * client_conf_prefetch_dns
+ *
+ * Resolve the manager host name in the background.
+ */
+void client_conf_prefetch_dns(ClientConf * conf);
+
+/*
+ * client_conf_warm_up_connection
+ *
+ * Open a connection to the manager in the background with a cheap request. The
+ * connection stays idle in the SoupSession pool, so that the next request to the
+ * manager does not wait for DNS, TCP and TLS.
+ */
+void client_conf_warm_up_connection(ClientConf * conf);
+
 /*
  * Setters for those options that can be saved to disk.
  */
@@ -160,7 +224,8 @@ gchar * client_conf_get_custom_client_logo(ClientConf * conf);
 /*
  * client_conf_save
  *
- * Save the configuration to file.
+ * Save the configuration to file now, if it changed. Changes made with the setters
+ * are also saved automatically, shortly after the last one.
  */
 void client_conf_save(ClientConf * conf);
 
@@ -27,6 +27,8 @@
 #include "flexdp.h"
 #include "flexvdi-port.h"
 #include "printclient-priv.h"
+#include "client-log.h"
+#include "client-timeline.h"
 
 typedef enum {
     WAIT_NEW_MESSAGE,
@@ -112,7 +114,19 @@ static void flexvdi_port_opened(FlexvdiPort * port);
 static void flexvdi_port_data(FlexvdiPort * port, gpointer data, int size);
 static void flexvdi_port_channel_event(SpiceChannel * channel, int event, FlexvdiPort * port);
 
+static void flexvdi_port_agent_disconnected(FlexvdiPort * port);
+
 void flexvdi_port_set_channel(FlexvdiPort * port, SpicePortChannel * channel) {
+    if (port->channel) {
+        // The session reconnected, forget the old channel
+        g_signal_handlers_disconnect_by_data(port->channel, port);
+        g_clear_object(&port->channel);
+        if (port->opened) {
+            port->opened = FALSE;
+            flexvdi_port_agent_disconnected(port);
+        }
+        g_clear_pointer(&port->name, g_free);
+    }
     port->channel = g_object_ref(channel);
     g_object_get(channel, "port-name", &port->name, NULL);
     g_signal_connect_swapped(channel, "notify::port-opened",
@@ -197,7 +211,7 @@ void flexvdi_port_send_msg_async(FlexvdiPort * port, uint32_t type, uint8_t * bu
     GTask * task = g_task_new(port, port->cancellable, callback, user_data);
     FlexVDIMessageHeader * head = (FlexVDIMessageHeader *)(buffer - HEADER_SIZE);
     size_t size = head->size + HEADER_SIZE;
-    g_debug("Port %s: sending message type %d, size %d", port->name, (int)type, (int)size);
+    CLIENT_DEBUG("Port %s: sending message type %d, size %d", port->name, (int)type, (int)size);
     head->type = type;
     marshallMessage(type, buffer, head->size);
     marshallHeader(head);
@@ -229,6 +243,7 @@ static void flexvdi_port_opened(FlexvdiPort * port) {
 
     if (opened) {
         g_info("Port %s: flexVDI agent is connected", port->name);
+        client_timeline_mark("agent connected on port %s", port->name);
         memset(port->agent_caps.caps, 0, sizeof(port->agent_caps));
         prepare_port_buffer(port, sizeof(FlexVDIMessageHeader));
         port->state = WAIT_NEW_MESSAGE;
@@ -248,15 +263,20 @@ static void flexvdi_port_opened(FlexvdiPort * port) {
         }
 
     } else {
-        g_info("Port %s: flexVDI agent is disconnected", port->name);
-        g_cancellable_cancel(port->cancellable);
-        g_object_unref(port->cancellable);
-        port->cancellable = g_cancellable_new();
-        g_signal_emit(port, signals[FLEXVDI_PORT_AGENT_CONNECTED], 0, FALSE);
+        flexvdi_port_agent_disconnected(port);
     }
 }
 
 
+static void flexvdi_port_agent_disconnected(FlexvdiPort * port) {
+    g_info("Port %s: flexVDI agent is disconnected", port->name);
+    g_cancellable_cancel(port->cancellable);
+    g_object_unref(port->cancellable);
+    port->cancellable = g_cancellable_new();
+    g_signal_emit(port, signals[FLEXVDI_PORT_AGENT_CONNECTED], 0, FALSE);
+}
+
+
 int flexvdi_port_agent_supports_capability(FlexvdiPort * port, int cap) {
     return supportsCapability(&port->agent_caps, cap);
 }
@@ -289,7 +309,7 @@ static void handle_message(FlexvdiPort * port) {
         gboolean handled = FALSE;
         g_signal_emit(port, signals[FLEXVDI_PORT_MESSAGE], 0,
             type, port->buffer, &handled);
-        g_debug("Message type %d was %shandled", type, handled ? "" : "not ");
+        CLIENT_DEBUG("Message type %d was %shandled", type, handled ? "" : "not ");
     }
 }
 
@@ -351,8 +371,8 @@ static void flexvdi_port_data(FlexvdiPort * port, gpointer data, int size) {
 
         case WAIT_DATA:
             // We were waiting for the data of the message
-            g_debug("Port %s: Received message type %u, size %u", port->name,
-                    port->current_header.type, port->current_header.size);
+            CLIENT_DEBUG("Port %s: Received message type %u, size %u", port->name,
+                         port->current_header.type, port->current_header.size);
             if (!unmarshallMessage(port->current_header.type, port->buffer, port->current_header.size)) {
                 g_warning("Port %s: Wrong message size on reception (%u)", port->name,
                           port->current_header.size);
@@ -22,6 +22,8 @@
 
 
 int main (int argc, char * argv[]) {
+    client_log_startup_mark("main");
     client_log_setup();
+    client_log_startup_mark("log setup");
     return g_application_run(G_APPLICATION(client_app_new()), argc, argv);
 }
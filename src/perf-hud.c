@@ -0,0 +1,218 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "perf-hud.h"
+
+
+struct _PerfHud {
+    GObject parent;
+    ClientConn * conn;
+    gint channel_id;
+    SpiceChannel * display;
+    guint frames;
+    guint frame_end_id;
+    gint64 last_sample;
+    gint64 last_cpu_time;
+    GHashTable * last_bytes;  // SpiceChannel -> bytes read at the last sample
+};
+
+G_DEFINE_TYPE(PerfHud, perf_hud, G_TYPE_OBJECT);
+
+
+static void perf_hud_dispose(GObject * obj);
+static void perf_hud_finalize(GObject * obj);
+
+static void perf_hud_class_init(PerfHudClass * class) {
+    GObjectClass * object_class = G_OBJECT_CLASS(class);
+    object_class->dispose = perf_hud_dispose;
+    object_class->finalize = perf_hud_finalize;
+}
+
+
+static void perf_hud_init(PerfHud * hud) {
+    hud->last_bytes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            g_object_unref, NULL);
+}
+
+
+static void perf_hud_dispose(GObject * obj) {
+    PerfHud * hud = PERF_HUD(obj);
+    if (hud->frame_end_id) {
+        g_source_remove(hud->frame_end_id);
+        hud->frame_end_id = 0;
+    }
+    if (hud->display) {
+        g_signal_handlers_disconnect_by_data(hud->display, hud);
+        g_clear_object(&hud->display);
+    }
+    if (hud->conn) {
+        g_signal_handlers_disconnect_by_data(client_conn_get_session(hud->conn), hud);
+        g_clear_object(&hud->conn);
+    }
+    g_hash_table_remove_all(hud->last_bytes);
+    G_OBJECT_CLASS(perf_hud_parent_class)->dispose(obj);
+}
+
+
+static void perf_hud_finalize(GObject * obj) {
+    PerfHud * hud = PERF_HUD(obj);
+    g_hash_table_unref(hud->last_bytes);
+    G_OBJECT_CLASS(perf_hud_parent_class)->finalize(obj);
+}
+
+
+/*
+ * CPU time used by this process, in microseconds.
+ */
+static gint64 get_cpu_time(void) {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    ULARGE_INTEGER k = { .LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime };
+    ULARGE_INTEGER u = { .LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime };
+    // In units of 100 ns
+    return (k.QuadPart + u.QuadPart) / 10;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+
+static gboolean frame_end(gpointer user_data) {
+    PERF_HUD(user_data)->frame_end_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * A frame is the set of updates of one main loop iteration, no matter how many
+ * areas they invalidate. Redraws of the widget, e.g. by overlays, are not frames.
+ */
+static void display_invalidate(SpiceChannel * channel, gint x, gint y, gint w, gint h,
+                               PerfHud * hud) {
+    if (hud->frame_end_id) return;
+    hud->frames++;
+    hud->frame_end_id = g_idle_add_full(G_PRIORITY_HIGH, frame_end, hud, NULL);
+}
+
+
+static void channel_new(SpiceSession * session, SpiceChannel * channel, PerfHud * hud) {
+    int id;
+    if (!SPICE_IS_DISPLAY_CHANNEL(channel)) return;
+    g_object_get(channel, "channel-id", &id, NULL);
+    if (id != hud->channel_id) return;
+    // The channel is created again after a reconnection
+    if (hud->display)
+        g_signal_handlers_disconnect_by_data(hud->display, hud);
+    g_set_object(&hud->display, channel);
+    g_signal_connect(channel, "display-invalidate", G_CALLBACK(display_invalidate), hud);
+}
+
+
+PerfHud * perf_hud_new(ClientConn * conn, gint channel_id) {
+    PerfHud * hud = PERF_HUD(g_object_new(PERF_HUD_TYPE, NULL));
+    SpiceSession * session = client_conn_get_session(conn);
+    GList * channels, * l;
+    hud->conn = g_object_ref(conn);
+    hud->channel_id = channel_id;
+    channels = spice_session_get_channels(session);
+    for (l = channels; l != NULL; l = l->next)
+        channel_new(session, SPICE_CHANNEL(l->data), hud);
+    g_list_free(channels);
+    g_signal_connect(session, "channel-new", G_CALLBACK(channel_new), hud);
+    hud->last_sample = g_get_monotonic_time();
+    hud->last_cpu_time = get_cpu_time();
+    return hud;
+}
+
+
+static void append_rate(GString * text, gdouble bytes_per_second) {
+    if (bytes_per_second >= 1024 * 1024)
+        g_string_append_printf(text, "%.1f MB/s", bytes_per_second / 1024 / 1024);
+    else
+        g_string_append_printf(text, "%.1f KB/s", bytes_per_second / 1024);
+}
+
+
+gchar * perf_hud_sample(PerfHud * hud) {
+    gint64 now = g_get_monotonic_time(), cpu_time = get_cpu_time();
+    gdouble elapsed = MAX(now - hud->last_sample, 1) / (gdouble)G_USEC_PER_SEC;
+    GString * text = g_string_new(NULL);
+    GString * channel_text = g_string_new(NULL);
+    gdouble display_rate = 0;
+    GList * channels, * l;
+
+    // Traffic of each channel, forgetting the channels that were destroyed
+    g_autoptr(GHashTable) last_bytes = hud->last_bytes;
+    hud->last_bytes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            g_object_unref, NULL);
+    channels = spice_session_get_channels(client_conn_get_session(hud->conn));
+    for (l = channels; l != NULL; l = l->next) {
+        SpiceChannel * channel = SPICE_CHANNEL(l->data);
+        gulong bytes, previous = 0;
+        gpointer value;
+        int id, type;
+        g_object_get(channel, "total-read-bytes", &bytes,
+                     "channel-id", &id, "channel-type", &type, NULL);
+        if (g_hash_table_lookup_extended(last_bytes, channel, NULL, &value))
+            previous = GPOINTER_TO_SIZE(value);
+        g_hash_table_insert(hud->last_bytes, g_object_ref(channel), GSIZE_TO_POINTER(bytes));
+
+        gdouble rate = (bytes - previous) / elapsed;
+        if (SPICE_IS_DISPLAY_CHANNEL(channel))
+            display_rate += rate;
+        g_string_append_printf(channel_text, "\n  %s %d: ", spice_channel_type_to_string(type), id);
+        append_rate(channel_text, rate);
+    }
+    g_list_free(channels);
+
+    gint64 rtt;
+    gsize queued;
+    client_conn_get_tunnel_stats(hud->conn, &rtt, &queued);
+
+    g_string_append_printf(text, "FPS: %.0f\nDisplay: ", hud->frames / elapsed);
+    append_rate(text, display_rate);
+    g_string_append(text, "\nChannels:");
+    g_string_append(text, channel_text->str);
+    // Only measured when a tunnel connects, n/a without WebSocket
+    if (rtt >= 0)
+        g_string_append_printf(text, "\nWS handshake RTT: %.1f ms", rtt / 1000.0);
+    else
+        g_string_append(text, "\nWS handshake RTT: n/a");
+    g_string_append_printf(text, "\nWS queue: %.1f KB", queued / 1024.0);
+    g_string_append_printf(text, "\nCPU: %.0f%%",
+                           (cpu_time - hud->last_cpu_time) / 10000.0 / elapsed);
+
+    hud->frames = 0;
+    hud->last_sample = now;
+    hud->last_cpu_time = cpu_time;
+    g_string_free(channel_text, TRUE);
+    return g_string_free(text, FALSE);
+}
@@ -0,0 +1,53 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PERF_HUD_H
+#define _PERF_HUD_H
+
+#include <glib-object.h>
+#include "client-conn.h"
+
+
+/*
+ * PerfHud
+ *
+ * Collects performance figures of a session to show them on screen: frames per
+ * second of a display channel, traffic of each channel, handshake round-trip time
+ * and queued bytes of the WebSocket tunnels, and CPU usage of the client process.
+ */
+#define PERF_HUD_TYPE (perf_hud_get_type())
+G_DECLARE_FINAL_TYPE(PerfHud, perf_hud, PERF, HUD, GObject)
+
+/*
+ * perf_hud_new
+ *
+ * Create a new PerfHud for a connection and one of its display channels.
+ */
+PerfHud * perf_hud_new(ClientConn * conn, gint channel_id);
+
+/*
+ * perf_hud_sample
+ *
+ * Take a sample of the figures since the previous one, and format them as text.
+ * Call it periodically, e.g. once a second.
+ */
+gchar * perf_hud_sample(PerfHud * hud);
+
+
+#endif /* _PERF_HUD_H */
@@ -35,8 +35,13 @@
 struct _PrintJobManager {
     GObject parent;
     GHashTable * print_jobs;
+    ClientScheduler * scheduler;
+    guint cleanup_id;
 };
 
+// Period of the removal of old job files, in seconds
+#define CLEANUP_PERIOD 300
+
 enum {
     PRINT_JOB_MANAGER_PDF = 0,
     PRINT_JOB_MANAGER_LAST_SIGNAL
@@ -71,19 +76,32 @@ static gboolean remove_temp_files(gpointer user_data);
 
 static void print_job_manager_init(PrintJobManager * pjb) {
     pjb->print_jobs = g_hash_table_new_full(g_direct_hash, NULL, NULL, g_free);
-    g_timeout_add_seconds(300, remove_temp_files, NULL);
 }
 
 
 static void print_job_manager_finalize(GObject * obj) {
     PrintJobManager * pjb = PRINT_JOB_MANAGER(obj);
+    if (pjb->scheduler) {
+        client_scheduler_remove(pjb->scheduler, pjb->cleanup_id);
+        g_object_unref(pjb->scheduler);
+    } else {
+        g_source_remove(pjb->cleanup_id);
+    }
     g_hash_table_unref(pjb->print_jobs);
     G_OBJECT_CLASS(print_job_manager_parent_class)->finalize(obj);
 }
 
 
-PrintJobManager * print_job_manager_new() {
-    return g_object_new(PRINT_JOB_MANAGER_TYPE, NULL);
+PrintJobManager * print_job_manager_new(ClientScheduler * scheduler) {
+    PrintJobManager * pjb = g_object_new(PRINT_JOB_MANAGER_TYPE, NULL);
+    if (scheduler) {
+        pjb->scheduler = g_object_ref(scheduler);
+        pjb->cleanup_id = client_scheduler_add_seconds(scheduler, CLEANUP_PERIOD,
+                                                       remove_temp_files, NULL);
+    } else {
+        pjb->cleanup_id = g_timeout_add_seconds(CLEANUP_PERIOD, remove_temp_files, NULL);
+    }
+    return pjb;
 }
 
 
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include "flexvdi-port.h"
+#include "client-scheduler.h"
 
 /*
  * PrintJobManager
@@ -32,7 +33,13 @@
 #define PRINT_JOB_MANAGER_TYPE (print_job_manager_get_type())
 G_DECLARE_FINAL_TYPE(PrintJobManager, print_job_manager, PRINT, JOB_MANAGER, GObject)
 
-PrintJobManager * print_job_manager_new();
+/*
+ * print_job_manager_new
+ *
+ * Create a new PrintJobManager. Old job files are removed periodically, with a
+ * timer of the scheduler if it is not NULL.
+ */
+PrintJobManager * print_job_manager_new(ClientScheduler * scheduler);
 
 gboolean print_job_manager_handle_message(
     PrintJobManager * pjb, uint32_t type, gpointer data);
@@ -0,0 +1,74 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SERIALREDIR_PRIV_H_
+#define _SERIALREDIR_PRIV_H_
+
+#include <glib.h>
+
+/*
+ * Serial redirection internals, used to drive the redirection without a Spice
+ * session, e.g. from tests with a pseudo-terminal as the serial device.
+ */
+
+typedef struct SerialPortOptions {
+    gchar ** params;        // "device,speed,mode" for each port, not copied
+    gsize buffer_size;
+    guint latency;
+    gboolean low_latency;
+    int vmin, vtime;
+} SerialPortOptions;
+
+/*
+ * serial_port_init_with_options
+ *
+ * Same as serial_port_init, with explicit options. Any previous ports must be closed.
+ */
+void serial_port_init_with_options(const SerialPortOptions * options);
+
+/*
+ * SerialPortGuestSink
+ *
+ * Receives the data that would be sent to the guest through the port channel.
+ */
+typedef void (* SerialPortGuestSink)(int port_number, const guint8 * data, gsize size,
+                                     gpointer user_data);
+
+/*
+ * serial_port_open_with_sink
+ *
+ * Open a serial port without a port channel, sending device data to a sink.
+ */
+void serial_port_open_with_sink(int port_number, SerialPortGuestSink sink, gpointer user_data);
+
+/*
+ * serial_port_close
+ *
+ * Close a serial port opened with serial_port_open_with_sink.
+ */
+void serial_port_close(int port_number);
+
+/*
+ * serial_port_guest_data
+ *
+ * Write data to the device as if it came from the guest.
+ */
+void serial_port_guest_data(int port_number, gconstpointer data, gsize size);
+
+#endif /* _SERIALREDIR_PRIV_H_ */
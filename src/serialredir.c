@@ -20,14 +20,22 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 #include "spice-client.h"
 #include "flexvdi-port.h"
 #include "spice-util.h"
 #include "serialredir.h"
+#include "serialredir-priv.h"
+#include "client-log.h"
 
 
 typedef struct SerialPort {
@@ -38,24 +46,99 @@ typedef struct SerialPort {
     struct termios tio;
     GInputStream * istream;
     GOutputStream * ostream;
+    // Data read from the device, waiting to be sent to the guest
+    guint8 * read_buffer;
+    GByteArray * pending;
+    guint flush_timeout_id;
+    gboolean reading;
+    gboolean sending;
+    // Data from the guest, waiting to be written to the device
+    GBytes * write_in_flight;
+    GByteArray * write_pending;
+    gboolean overflowed;
+    SerialPortStats stats;
+    // Low latency mode: a thread reads from its own descriptor
+    GThread * thread;
+    int read_fd;
+    // Bytes read by the thread and not sent yet; it waits while they fill the buffer
+    GMutex backlog_mutex;
+    GCond backlog_cond;
+    gsize backlog;
+    // Replaces the port channel, see serialredir-priv.h
+    SerialPortGuestSink sink;
+    gpointer sink_data;
 } SerialPort;
 
 
 static gchar ** serial_params;
 static SerialPort * serial_ports;
 static int num_ports;
+static gsize buffer_size;
+static guint latency;
+static gboolean low_latency;
+static int vmin, vtime;
 
+// Maximum amount of guest data queued for a device
+#define WRITE_QUEUE_LIMIT (1024 * 1024)
 
-void serial_port_init(ClientConf * conf) {
-    serial_params = client_conf_get_serial_params(conf);
+
+static void free_serial_ports() {
+    int port_number;
+    for (port_number = 0; port_number < num_ports; ++port_number) {
+        g_free(serial_ports[port_number].device_name);
+        g_free(serial_ports[port_number].read_buffer);
+        g_byte_array_unref(serial_ports[port_number].pending);
+        g_byte_array_unref(serial_ports[port_number].write_pending);
+        g_mutex_clear(&serial_ports[port_number].backlog_mutex);
+        g_cond_clear(&serial_ports[port_number].backlog_cond);
+    }
+    g_clear_pointer(&serial_ports, g_free);
     num_ports = 0;
+}
+
+
+void serial_port_init_with_options(const SerialPortOptions * options) {
+    int port_number;
+    free_serial_ports();
+    serial_params = options->params;
+    buffer_size = options->buffer_size;
+    latency = options->latency;
+    low_latency = options->low_latency;
+    // VMIN and VTIME only tune the reads of the low latency thread
+    vmin = low_latency ? options->vmin : 1;
+    vtime = low_latency ? options->vtime : 5;
+    if (vmin > 1 && vtime == 0) {
+        // The reader thread could block forever waiting for vmin characters
+        g_warning("Serial port VMIN needs a VTIME, using VMIN = 1");
+        vmin = 1;
+    }
     if (serial_params) {
         while (serial_params[num_ports]) ++num_ports;
         serial_ports = g_malloc0(sizeof(SerialPort) * num_ports);
+        for (port_number = 0; port_number < num_ports; ++port_number) {
+            serial_ports[port_number].read_buffer = g_malloc(buffer_size);
+            serial_ports[port_number].pending = g_byte_array_sized_new(buffer_size);
+            serial_ports[port_number].write_pending = g_byte_array_new();
+            g_mutex_init(&serial_ports[port_number].backlog_mutex);
+            g_cond_init(&serial_ports[port_number].backlog_cond);
+        }
     }
 }
 
 
+void serial_port_init(ClientConf * conf) {
+    SerialPortOptions options = {
+        .params = client_conf_get_serial_params(conf),
+        .buffer_size = client_conf_get_serial_buffer_size(conf),
+        .latency = client_conf_get_serial_latency(conf),
+        .low_latency = client_conf_get_serial_low_latency(conf),
+        .vmin = client_conf_get_serial_vmin(conf),
+        .vtime = client_conf_get_serial_vtime(conf),
+    };
+    serial_port_init_with_options(&options);
+}
+
+
 static SerialPort * get_serial_port(SpicePortChannel * channel) {
     int port_number;
     for (port_number = 0; port_number < num_ports; ++port_number)
@@ -67,24 +150,40 @@ static SerialPort * get_serial_port(SpicePortChannel * channel) {
 
 typedef struct SerialPortBuffer {
     SerialPort * serial;
-    char data;
+    GCancellable * cancellable;
+    GBytes * data;
 } SerialPortBuffer;
 
 
-static SerialPortBuffer * get_buffer(SerialPort * serial) {
-    SerialPortBuffer * buffer = g_malloc(sizeof(SerialPortBuffer));
-    buffer->serial = serial;
-    return buffer;
-}
-
-
 static void close_serial(SerialPort * serial) {
     SPICE_DEBUG("Closing serial device");
     g_cancellable_cancel(serial->cancellable);
-    close(serial->fd);
+    if (serial->thread) {
+        g_mutex_lock(&serial->backlog_mutex);
+        g_cond_signal(&serial->backlog_cond);
+        g_mutex_unlock(&serial->backlog_mutex);
+        g_thread_join(serial->thread);
+        serial->thread = NULL;
+        serial->backlog = 0;
+    }
+    if (serial->read_fd > 0)
+        close(serial->read_fd);
+    serial->read_fd = 0;
+    if (serial->flush_timeout_id) {
+        g_source_remove(serial->flush_timeout_id);
+        serial->flush_timeout_id = 0;
+    }
+    g_byte_array_set_size(serial->pending, 0);
+    serial->reading = serial->sending = FALSE;
+    g_clear_pointer(&serial->write_in_flight, g_bytes_unref);
+    g_byte_array_set_size(serial->write_pending, 0);
+    serial->stats.queued_bytes = 0;
+    serial->overflowed = FALSE;
+    if (serial->fd > 0)
+        close(serial->fd);
     serial->fd = 0;
-    g_object_unref(serial->istream);
-    g_object_unref(serial->ostream);
+    g_clear_object(&serial->istream);
+    g_clear_object(&serial->ostream);
 }
 
 
@@ -101,8 +200,8 @@ static void set_serial_params(SerialPort * serial, const char * device,
     serial->tio.c_oflag = 0;
     serial->tio.c_cflag = CREAD | CLOCAL;
     serial->tio.c_lflag = 0;
-    serial->tio.c_cc[VMIN] = 1;
-    serial->tio.c_cc[VTIME] = 5;
+    serial->tio.c_cc[VMIN] = vmin;
+    serial->tio.c_cc[VTIME] = vtime;
 
     if (strlen(mode) == 3) {
         switch (mode[0] - '0') {
@@ -172,57 +271,283 @@ static void parse_serial_params(SerialPort * serial, const char * serial_params)
 }
 
 
+static void start_read(SerialPort * serial);
+static void flush_pending(SerialPort * serial);
+
+static void send_done(SerialPortBuffer * buffer, GError * error) {
+    SerialPort * serial = buffer->serial;
+    gboolean cancelled = g_cancellable_is_cancelled(buffer->cancellable);
+    if (error) {
+        if (!cancelled)
+            g_warning("Error sending data to guest: %s", error->message);
+    } else {
+        CLIENT_DEBUG("%d bytes sent to serial port %d\n",
+                     (int)g_bytes_get_size(buffer->data), (int)(serial - serial_ports));
+    }
+    g_bytes_unref(buffer->data);
+    g_object_unref(buffer->cancellable);
+    g_free(buffer);
+
+    // The port was closed while the data was being sent
+    if (cancelled) return;
+
+    serial->sending = FALSE;
+    // Send whatever arrived in the meantime, unless the latency timer is still running
+    if (!serial->flush_timeout_id)
+        flush_pending(serial);
+}
+
+
 static void send_cb(GObject * source, GAsyncResult * res, gpointer user_data) {
     GError *error = NULL;
     SpicePortChannel * channel = (SpicePortChannel *)source;
-    SerialPortBuffer * buffer = (SerialPortBuffer *)user_data;
     spice_port_channel_write_finish(channel, res, &error);
-    g_debug("Data sent to serial port %d\n", (int)(buffer->serial - serial_ports));
-    if (error) {
-        g_warning("Error sending data to guest: %s", error->message);
-        g_clear_error(&error);
+    send_done((SerialPortBuffer *)user_data, error);
+    g_clear_error(&error);
+}
+
+
+/*
+ * Send the pending data to the guest in a single port write. Only one write is in
+ * flight at a time, so that data arrives at the guest in the same order it was read.
+ */
+static void flush_pending(SerialPort * serial) {
+    if (serial->flush_timeout_id) {
+        g_source_remove(serial->flush_timeout_id);
+        serial->flush_timeout_id = 0;
+    }
+    if (serial->sending || serial->pending->len == 0) return;
+
+    SerialPortBuffer * buffer = g_new(SerialPortBuffer, 1);
+    buffer->serial = serial;
+    buffer->cancellable = g_object_ref(serial->cancellable);
+    buffer->data = g_byte_array_free_to_bytes(serial->pending);
+    serial->pending = g_byte_array_sized_new(buffer_size);
+    serial->sending = TRUE;
+    if (serial->thread) {
+        g_mutex_lock(&serial->backlog_mutex);
+        serial->backlog -= g_bytes_get_size(buffer->data);
+        g_cond_signal(&serial->backlog_cond);
+        g_mutex_unlock(&serial->backlog_mutex);
     }
-    g_free(user_data);
+    if (serial->sink) {
+        serial->sink(serial - serial_ports, g_bytes_get_data(buffer->data, NULL),
+                     g_bytes_get_size(buffer->data), serial->sink_data);
+        send_done(buffer, NULL);
+    } else {
+        spice_port_channel_write_async(serial->channel,
+                                       g_bytes_get_data(buffer->data, NULL),
+                                       g_bytes_get_size(buffer->data),
+                                       serial->cancellable, send_cb, buffer);
+    }
+
+    // Reading stops while the pending buffer is full
+    if (!serial->reading && !serial->thread)
+        start_read(serial);
+}
+
+
+static gboolean flush_timeout_cb(gpointer user_data) {
+    SerialPort * serial = (SerialPort *)user_data;
+    serial->flush_timeout_id = 0;
+    flush_pending(serial);
+    return G_SOURCE_REMOVE;
 }
 
 
 static void read_cb(GObject * source, GAsyncResult * res, gpointer user_data) {
     GError *error = NULL;
     GInputStream * istream = (GInputStream *)source;
-    SerialPortBuffer * buffer;
-    SerialPort * serial;
-    if (istream) {
-        buffer = (SerialPortBuffer *)user_data;
-        serial = buffer->serial;
-        if (g_input_stream_read_finish(istream, res, &error) == 1) {
-            g_debug("Data from serial device %s: 0x%.2hhX\n",
-                       serial->device_name, buffer->data);
-            spice_port_channel_write_async(serial->channel, &buffer->data, 1,
-                                           serial->cancellable, send_cb, buffer);
-        } else {
-            g_warning("Error reading from serial device: %s", error->message);
-            g_free(user_data);
-            g_clear_error(&error);
-            return;
-        }
-    } else {
-        serial = (SerialPort *)user_data;
+    SerialPort * serial = (SerialPort *)user_data;
+    gssize size = g_input_stream_read_finish(istream, res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) || istream != serial->istream) {
+        // The device was closed
+        g_clear_error(&error);
+        return;
+    }
+
+    serial->reading = FALSE;
+    if (size <= 0) {
+        g_warning("Error reading from serial device %s: %s", serial->device_name,
+                  error ? error->message : "end of file");
+        g_clear_error(&error);
+        return;
+    }
+
+    CLIENT_DEBUG("Data from serial device %s: %d bytes\n", serial->device_name, (int)size);
+    g_byte_array_append(serial->pending, serial->read_buffer, size);
+    if (serial->pending->len >= buffer_size || latency == 0) {
+        flush_pending(serial);
+    } else if (!serial->flush_timeout_id) {
+        serial->flush_timeout_id = g_timeout_add(latency, flush_timeout_cb, serial);
+    }
+
+    if (!serial->reading && serial->pending->len < buffer_size)
+        start_read(serial);
+}
+
+
+/*
+ * Read as much data as available, up to the free space in the pending buffer.
+ */
+static void start_read(SerialPort * serial) {
+    serial->reading = TRUE;
+    g_input_stream_read_async(serial->istream, serial->read_buffer,
+                              buffer_size - serial->pending->len, G_PRIORITY_DEFAULT,
+                              serial->cancellable, read_cb, serial);
+}
+
+
+static void write_cb(GObject * source, GAsyncResult * res, gpointer user_data);
+
+/*
+ * Write the rest of the chunk in flight, or the next one. Data that arrived while
+ * the previous write was in flight is written in a single chunk.
+ */
+static void next_write(SerialPort * serial) {
+    if (serial->write_in_flight == NULL) {
+        if (serial->write_pending->len == 0) return;
+        serial->write_in_flight = g_byte_array_free_to_bytes(serial->write_pending);
+        serial->write_pending = g_byte_array_new();
     }
-    buffer = get_buffer(serial);
-    g_input_stream_read_async(serial->istream, &buffer->data, 1, G_PRIORITY_DEFAULT,
-                              serial->cancellable, read_cb, buffer);
+    ++serial->stats.writes;
+    g_output_stream_write_bytes_async(serial->ostream, serial->write_in_flight,
+                                      G_PRIORITY_DEFAULT, serial->cancellable,
+                                      write_cb, serial);
 }
 
 
 static void write_cb(GObject * source, GAsyncResult * res, gpointer user_data) {
     GError * error = NULL;
     GOutputStream * ostream = (GOutputStream *)source;
-    g_output_stream_write_finish(ostream, res, &error);
+    SerialPort * serial = (SerialPort *)user_data;
+    gssize size = g_output_stream_write_bytes_finish(ostream, res, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) || ostream != serial->ostream) {
+        // The device was closed
+        g_clear_error(&error);
+        return;
+    }
+
     if (error) {
         g_warning("Error writing to serial device: %s\n", error->message);
+        g_clear_error(&error);
+        // Discard the failed chunk, but keep on with the rest
+        size = g_bytes_get_size(serial->write_in_flight);
+        serial->stats.dropped_bytes += size;
+    } else {
+        serial->stats.written_bytes += size;
     }
-    g_clear_error(&error);
-    g_free(user_data);
+
+    GBytes * bytes = serial->write_in_flight;
+    gsize bsize = g_bytes_get_size(bytes);
+    serial->stats.queued_bytes -= size;
+    if (serial->overflowed && serial->stats.queued_bytes == 0) {
+        g_message("Serial device %s caught up, accepting data again", serial->device_name);
+        serial->overflowed = FALSE;
+    }
+    if (size < bsize) {
+        // Short write, send the rest
+        serial->write_in_flight = g_bytes_new_from_bytes(bytes, size, bsize - size);
+    } else {
+        serial->write_in_flight = NULL;
+    }
+    g_bytes_unref(bytes);
+    next_write(serial);
+}
+
+
+typedef struct SerialChunk {
+    SerialPort * serial;
+    GCancellable * cancellable;
+    gsize size;
+    guint8 data[];
+} SerialChunk;
+
+
+/*
+ * Deliver a chunk read by the reader thread, in the main context.
+ */
+static gboolean deliver_chunk(gpointer user_data) {
+    SerialChunk * chunk = (SerialChunk *)user_data;
+    SerialPort * serial = chunk->serial;
+    if (!g_cancellable_is_cancelled(chunk->cancellable)) {
+        CLIENT_DEBUG("Data from serial device %s: %d bytes\n", serial->device_name, (int)chunk->size);
+        g_byte_array_append(serial->pending, chunk->data, chunk->size);
+        flush_pending(serial);
+    }
+    g_object_unref(chunk->cancellable);
+    g_free(chunk);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * Reader thread of the low latency mode. It waits for data with poll, and reads
+ * it with the VMIN/VTIME semantics of the device. Data is handed to the main
+ * context with a high priority idle source, so that it does not wait for rendering.
+ * Like start_read, it stops reading while the pending buffer is full.
+ */
+static gpointer serial_reader_thread(gpointer user_data) {
+    SerialPort * serial = (SerialPort *)user_data;
+    GCancellable * cancellable = serial->cancellable;
+    struct pollfd fds[2] = {
+        { .fd = serial->read_fd, .events = POLLIN },
+        { .fd = g_cancellable_get_fd(cancellable), .events = POLLIN },
+    };
+
+    while (!g_cancellable_is_cancelled(cancellable)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            g_warning("Error polling serial device %s: %s", serial->device_name, g_strerror(errno));
+            break;
+        }
+        if (fds[1].revents) break;
+        g_mutex_lock(&serial->backlog_mutex);
+        while (serial->backlog >= buffer_size && !g_cancellable_is_cancelled(cancellable))
+            g_cond_wait(&serial->backlog_cond, &serial->backlog_mutex);
+        gsize free_space = buffer_size - serial->backlog;
+        g_mutex_unlock(&serial->backlog_mutex);
+        if (g_cancellable_is_cancelled(cancellable)) break;
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            g_warning("Serial device %s was closed", serial->device_name);
+            break;
+        }
+        ssize_t size = read(serial->read_fd, serial->read_buffer, free_space);
+        if (size < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            g_warning("Error reading from serial device %s: %s", serial->device_name, g_strerror(errno));
+            break;
+        } else if (size == 0) {
+            g_warning("Error reading from serial device %s: end of file", serial->device_name);
+            break;
+        }
+        g_mutex_lock(&serial->backlog_mutex);
+        serial->backlog += size;
+        g_mutex_unlock(&serial->backlog_mutex);
+        SerialChunk * chunk = g_malloc(sizeof(SerialChunk) + size);
+        chunk->serial = serial;
+        chunk->cancellable = g_object_ref(cancellable);
+        chunk->size = size;
+        memcpy(chunk->data, serial->read_buffer, size);
+        g_idle_add_full(G_PRIORITY_HIGH, deliver_chunk, chunk, NULL);
+    }
+
+    g_cancellable_release_fd(cancellable);
+    return NULL;
+}
+
+
+static void set_low_latency(int fd) {
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &ss) == 0) return;
+    }
+#endif
+    g_debug("Low latency flag not supported by this serial device\n");
 }
 
 
@@ -242,12 +567,46 @@ static void open_serial(SerialPort * serial) {
     }
     serial->istream = g_unix_input_stream_new(serial->fd, FALSE);
     serial->ostream = g_unix_output_stream_new(serial->fd, FALSE);
-    read_cb(NULL, NULL, serial);
+
+    if (low_latency) {
+        // A blocking descriptor, so that VMIN and VTIME apply
+        serial->read_fd = open(serial->device_name, O_RDONLY | O_NOCTTY);
+        if (serial->read_fd > 0) {
+            set_low_latency(serial->read_fd);
+            serial->thread = g_thread_try_new("serialredir", serial_reader_thread, serial, NULL);
+            if (serial->thread) return;
+            close(serial->read_fd);
+        }
+        serial->read_fd = 0;
+        g_warning("Could not start low latency mode on %s\n", serial->device_name);
+    }
+    start_read(serial);
 }
 
 
 static void serial_port_data(SpicePortChannel * channel, gpointer data, int size);
 
+static void open_port(int port_number, SpicePortChannel * channel,
+                      SerialPortGuestSink sink, gpointer sink_data) {
+    SerialPort * serial = &serial_ports[port_number];
+    serial->cancellable = g_cancellable_new();
+    serial->channel = channel;
+    serial->sink = sink;
+    serial->sink_data = sink_data;
+    parse_serial_params(serial, serial_params[port_number]);
+    open_serial(serial);
+}
+
+
+static void close_port(int port_number) {
+    SerialPort * serial = &serial_ports[port_number];
+    serial->channel = NULL;
+    serial->sink = NULL;
+    close_serial(serial);
+    g_clear_object(&serial->cancellable);
+}
+
+
 void serial_port_open(SpiceChannel * channel) {
     g_autofree gchar * name = NULL;
     gboolean opened = FALSE;
@@ -255,31 +614,99 @@ void serial_port_open(SpiceChannel * channel) {
     if (!strncmp(name, "serialredir", 11)) {
         int port_number = atoi(&name[11]);
         if (port_number < 0 || port_number >= num_ports) return;
-        SerialPort * serial = &serial_ports[port_number];
         if (opened) {
             g_signal_connect(channel, "port-data", G_CALLBACK(serial_port_data), NULL);
             g_debug("Opened channel %s for serial port %d\n", name, port_number);
-            serial->cancellable = g_cancellable_new();
-            serial->channel = SPICE_PORT_CHANNEL(channel);
-            parse_serial_params(serial, serial_params[port_number]);
-            open_serial(serial);
+            open_port(port_number, SPICE_PORT_CHANNEL(channel), NULL, NULL);
         } else {
-            serial->channel = NULL;
-            close_serial(serial);
-            g_object_unref(serial->cancellable);
-            serial->cancellable = NULL;
+            close_port(port_number);
             g_signal_handlers_disconnect_by_func(channel, G_CALLBACK(serial_port_data), NULL);
         }
     }
 }
 
 
+void serial_port_open_with_sink(int port_number, SerialPortGuestSink sink, gpointer user_data) {
+    if (port_number < 0 || port_number >= num_ports) return;
+    open_port(port_number, NULL, sink, user_data);
+}
+
+
+void serial_port_close(int port_number) {
+    if (port_number < 0 || port_number >= num_ports) return;
+    close_port(port_number);
+}
+
+
+/*
+ * Port channels have no flow control: the guest cannot be throttled, since spice-gtk
+ * keeps reading the channel and emits port-data regardless. So the queue is bounded,
+ * and once it overflows, all the guest data is discarded until the device has written
+ * the whole queue. Discarding a chunk but accepting later ones would leave a hole
+ * in the middle of the byte stream, which the device protocol cannot detect; this way
+ * the device sees a clean cut instead.
+ */
+static void write_to_device(SerialPort * serial, gconstpointer data, gsize size) {
+    if (serial->ostream) {
+        CLIENT_DEBUG("Data to serial device %s: %d bytes\n", serial->device_name, (int)size);
+        if (serial->overflowed) {
+            serial->stats.dropped_bytes += size;
+            return;
+        }
+        if (serial->stats.queued_bytes == 0) {
+            // Nothing queued, try to write directly without copying the data
+            GError * error = NULL;
+            gssize written = g_pollable_output_stream_write_nonblocking(
+                G_POLLABLE_OUTPUT_STREAM(serial->ostream), data, size, NULL, &error);
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+                g_clear_error(&error);
+                written = 0;
+            } else if (error) {
+                g_warning("Error writing to serial device: %s\n", error->message);
+                g_clear_error(&error);
+                return;
+            }
+            serial->stats.written_bytes += written;
+            data = (const guint8 *)data + written;
+            size -= written;
+            if (size == 0) return;
+        }
+
+        // An empty queue takes any chunk, so that an overflow always ends with write_cb
+        if (serial->stats.queued_bytes > 0 &&
+            serial->stats.queued_bytes + size > WRITE_QUEUE_LIMIT) {
+            g_warning("Serial device %s is too slow, discarding data until it catches up",
+                      serial->device_name);
+            serial->overflowed = TRUE;
+            serial->stats.dropped_bytes += size;
+            return;
+        }
+
+        g_byte_array_append(serial->write_pending, data, size);
+        serial->stats.queued_bytes += size;
+        if (serial->stats.queued_bytes > serial->stats.max_queued_bytes)
+            serial->stats.max_queued_bytes = serial->stats.queued_bytes;
+        if (serial->write_in_flight == NULL)
+            next_write(serial);
+    }
+}
+
+
 static void serial_port_data(SpicePortChannel * channel, gpointer data, int size) {
     SerialPort * serial = get_serial_port(channel);
-    if (serial) {
-        g_debug("Data to serial device: 0x%.2hhX\n", *((char *)data));
-        gpointer wbuffer = g_memdup(data, size);
-        g_output_stream_write_async(serial->ostream, wbuffer, size, G_PRIORITY_DEFAULT,
-                                    serial->cancellable, write_cb, wbuffer);
-    }
+    if (serial)
+        write_to_device(serial, data, size);
+}
+
+
+void serial_port_guest_data(int port_number, gconstpointer data, gsize size) {
+    if (port_number < 0 || port_number >= num_ports) return;
+    write_to_device(&serial_ports[port_number], data, size);
+}
+
+
+gboolean serial_port_get_stats(int port_number, SerialPortStats * stats) {
+    if (port_number < 0 || port_number >= num_ports) return FALSE;
+    *stats = serial_ports[port_number].stats;
+    return TRUE;
 }
@@ -23,7 +23,16 @@
 #include "spice-client.h"
 #include "configuration.h"
 
+typedef struct SerialPortStats {
+    gsize queued_bytes;       // Guest data waiting to be written to the device
+    gsize max_queued_bytes;   // Highest value of queued_bytes
+    guint64 written_bytes;    // Guest data written to the device
+    guint64 dropped_bytes;    // Guest data discarded because the queue was full
+    guint64 writes;           // Asynchronous writes issued to the device
+} SerialPortStats;
+
 void serial_port_init(ClientConf * conf);
 void serial_port_open(SpiceChannel * channel);
+gboolean serial_port_get_stats(int port_number, SerialPortStats * stats);
 
 #endif // SERIALREDIR_H
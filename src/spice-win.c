@@ -21,6 +21,8 @@
 #include "flexvdi-port.h"
 #include "printclient.h"
 #include "about.h"
+#include "client-timeline.h"
+#include "perf-hud.h"
 
 #ifdef __APPLE__
 #include <gdk/gdkquartz.h>
@@ -34,8 +36,8 @@ struct _SpiceWindow {
     GtkApplicationWindow parent;
     ClientConn * conn;
     ClientConf * conf;
+    ClientScheduler * scheduler;
     gint id;
-    SpiceChannel * display_channel;
     gint width, height;
     gboolean initially_fullscreen;
     gboolean fullscreen;
@@ -66,9 +68,20 @@ struct _SpiceWindow {
     GtkLabel * notification;
     GtkToolButton * about_button;
     guint notification_timeout_id;
-    gulong channel_event_handler_id;
+    guint toolbar_timeout_id;
+    gboolean reconnecting;
+    // Performance overlay, shown in the notification area
+    PerfHud * hud;
+    guint hud_timeout_id;
+    // Input hot path state
+    WindowEdge toolbar_edge;
+    gdouble edge_x, edge_y;
+    gint64 last_activity, last_activity_signal;
 };
 
+// Minimum time between user-activity signals, in us
+#define ACTIVITY_SIGNAL_INTERVAL G_USEC_PER_SEC
+
 enum {
     SPICE_WIN_USER_ACTIVITY = 0,
     SPICE_WIN_LAST_SIGNAL
@@ -140,12 +153,24 @@ static gboolean leave_event(GtkWidget * widget, GdkEventCrossing * event, gpoint
 static void spice_window_get_printers(SpiceWindow * win);
 static void guest_agent_connected(FlexvdiPort * port, gboolean connected, SpiceWindow * win);
 
+static void toggle_perf_hud(GSimpleAction * action, GVariant * value, gpointer user_data);
+
 static GActionEntry keystroke_entry[] = {
     { "keystroke", keystroke, "s", NULL, NULL },
+    { "perf-hud", NULL, NULL, "false", toggle_perf_hud },
 };
 
+/*
+ * Input events arrive at a high rate, just save the time and emit the user-activity
+ * signal at most once every ACTIVITY_SIGNAL_INTERVAL. The first event after a
+ * quiet period is always signaled.
+ */
 static gboolean user_activity(SpiceWindow * win) {
-    g_signal_emit(win, signals[SPICE_WIN_USER_ACTIVITY], 0);
+    win->last_activity = g_get_monotonic_time();
+    if (win->last_activity - win->last_activity_signal >= ACTIVITY_SIGNAL_INTERVAL) {
+        win->last_activity_signal = win->last_activity;
+        g_signal_emit(win, signals[SPICE_WIN_USER_ACTIVITY], 0);
+    }
     return GDK_EVENT_PROPAGATE;
 }
 
@@ -170,7 +195,8 @@ static void spice_window_init(SpiceWindow * win) {
     g_signal_connect(win, "leave-notify-event", G_CALLBACK(leave_event), NULL);
 #endif
 
-    g_action_map_add_action_entries(G_ACTION_MAP(win), keystroke_entry, 1, win);
+    g_action_map_add_action_entries(G_ACTION_MAP(win), keystroke_entry,
+                                    G_N_ELEMENTS(keystroke_entry), win);
     GtkBuilder * builder = gtk_builder_new_from_resource(
 #ifdef WIN32
         "/com/flexvdi/client/keys-menu-windows.ui"
@@ -191,11 +217,16 @@ static void spice_window_init(SpiceWindow * win) {
 
 static void spice_window_dispose(GObject * obj) {
     SpiceWindow * win = SPICE_WIN(obj);
+    if (win->scheduler) {
+        client_scheduler_remove(win->scheduler, win->notification_timeout_id);
+        client_scheduler_remove(win->scheduler, win->toolbar_timeout_id);
+        client_scheduler_remove(win->scheduler, win->hud_timeout_id);
+        win->notification_timeout_id = win->toolbar_timeout_id = win->hud_timeout_id = 0;
+    }
+    g_clear_object(&win->hud);
+    g_clear_object(&win->scheduler);
     g_clear_object(&win->conn);
     g_clear_object(&win->conf);
-    if (win->display_channel)
-        g_signal_handler_disconnect(win->display_channel, win->channel_event_handler_id);
-    g_clear_object(&win->display_channel);
     if (win->printer_name_for_actions)
         g_hash_table_unref(win->printer_name_for_actions);
     win->printer_name_for_actions = NULL;
@@ -208,28 +239,26 @@ static void spice_window_finalize(GObject * obj) {
     G_OBJECT_CLASS(spice_window_parent_class)->finalize(obj);
 }
 
-static void channel_event(SpiceChannel * channel, SpiceChannelEvent event, gpointer user_data);
 static gboolean motion_notify_event_cb(GtkWidget * widget, GdkEventMotion * event,
                                        gpointer user_data);
 static gboolean leave_window_cb(GtkWidget * widget, GdkEventCrossing * event,
                                 gpointer user_data);
 static void mouse_grab_cb(SpiceDisplay * display, gint status, gpointer user_data);
 static void spice_size_allocate(GtkWidget * widget, GdkRectangle * a, gpointer user_data);
+static void update_toolbar_edge(SpiceWindow * win, gint width, gint height);
 
 void usb_connect_failed(GObject * object, SpiceUsbDevice * device,
                         GError * error, gpointer user_data);
 
-SpiceWindow * spice_window_new(ClientConn * conn, SpiceChannel * channel,
-                               ClientConf * conf, int id, gchar * title) {
+SpiceWindow * spice_window_new(ClientConn * conn, ClientConf * conf, ClientScheduler * scheduler,
+                               int id, gchar * title) {
     SpiceWindow * win = g_object_new(SPICE_WIN_TYPE,
                                      "title", title,
                                      NULL);
     win->id = id;
     win->conn = g_object_ref(conn);
     win->conf = g_object_ref(conf);
-    win->display_channel = g_object_ref(channel);
-    win->channel_event_handler_id =
-        g_signal_connect(channel, "channel-event", G_CALLBACK(channel_event), win);
+    win->scheduler = g_object_ref(scheduler);
 
     /* spice display */
     SpiceSession * session = client_conn_get_session(conn);
@@ -295,7 +324,9 @@ SpiceWindow * spice_window_new(ClientConn * conn, SpiceChannel * channel,
         gtk_window_set_default_size(GTK_WINDOW(win), win->width, win->height);
     }
 
-    switch (client_conf_get_toolbar_edge(conf)) {
+    win->toolbar_edge = client_conf_get_toolbar_edge(conf);
+    update_toolbar_edge(win, 0, 0);
+    switch (win->toolbar_edge) {
         case WINDOW_EDGE_DOWN:
             g_object_set(win->revealer,
                          "transition-type", GTK_REVEALER_TRANSITION_TYPE_SLIDE_UP,
@@ -397,8 +428,27 @@ static gboolean configure_event(GtkWidget * widget, GdkEvent * event, gpointer u
     return GDK_EVENT_PROPAGATE;
 }
 
+/*
+ * Compute the coordinates of the display edge where the toolbar is shown, for a
+ * display size, so that motion events only compare them.
+ */
+static void update_toolbar_edge(SpiceWindow * win, gint width, gint height) {
+    win->edge_x = win->edge_y = -1000000.0;
+    switch (win->toolbar_edge) {
+        case WINDOW_EDGE_DOWN:
+            win->edge_y = height - 1.0; break;
+        case WINDOW_EDGE_LEFT:
+            win->edge_x = 0.0; break;
+        case WINDOW_EDGE_RIGHT:
+            win->edge_x = width - 1.0; break;
+        default:
+            win->edge_y = 0.0; break;
+    }
+}
+
 static void spice_size_allocate(GtkWidget * widget, GdkRectangle * a, gpointer user_data) {
     SpiceWindow * win = SPICE_WIN(user_data);
+    update_toolbar_edge(win, a->width, a->height);
 
     // Save the window geometry only if we are not maximized or fullscreen.
     if (!(win->maximized || win->fullscreen)) {
@@ -422,24 +472,6 @@ gboolean map_event(GtkWidget * widget, GdkEvent * event, gpointer user_data) {
     return GDK_EVENT_PROPAGATE;
 }
 
-static void channel_event(SpiceChannel * channel, SpiceChannelEvent event, gpointer user_data) {
-    SpiceWindow * win = SPICE_WIN(user_data);
-
-    switch (event) {
-    case SPICE_CHANNEL_CLOSED:
-        client_conn_disconnect(win->conn, CLIENT_CONN_DISCONNECT_NO_ERROR);
-        return;
-    case SPICE_CHANNEL_ERROR_IO:
-    case SPICE_CHANNEL_ERROR_TLS:
-    case SPICE_CHANNEL_ERROR_LINK:
-    case SPICE_CHANNEL_ERROR_CONNECT:
-    case SPICE_CHANNEL_ERROR_AUTH:
-        client_conn_disconnect(win->conn, CLIENT_CONN_DISCONNECT_CONN_ERROR);
-    default:
-        return;
-    }
-}
-
 static void copy_from_guest(GtkToolButton * toolbutton, gpointer user_data) {
     SpiceWindow * win = SPICE_WIN(user_data);
     spice_gtk_session_paste_from_guest(
@@ -595,49 +627,57 @@ static void power_event_cb(GtkToolButton * toolbutton, gpointer user_data) {
     }
 }
 
-static gboolean hide_widget_cb(gpointer user_data) {
-    GtkRevealer * revealer = GTK_REVEALER(user_data);
+static void hide_revealer(GtkRevealer * revealer) {
     if (!gtk_revealer_get_reveal_child(revealer))
         gtk_widget_hide(GTK_WIDGET(revealer));
+}
+
+static gboolean hide_toolbar_cb(gpointer user_data) {
+    SpiceWindow * win = SPICE_WIN(user_data);
+    win->toolbar_timeout_id = 0;
+    hide_revealer(win->revealer);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean hide_notification_cb(gpointer user_data) {
+    SpiceWindow * win = SPICE_WIN(user_data);
+    win->notification_timeout_id = 0;
+    hide_revealer(win->notification_revealer);
     return G_SOURCE_REMOVE;
 }
 
 static gboolean motion_notify_event_cb(GtkWidget * widget, GdkEventMotion * event,
                                        gpointer user_data) {
     SpiceWindow * win = SPICE_WIN(user_data);
-    gdouble edge_x = -1000000.0, edge_y = -1000000.0;
-    switch (client_conf_get_toolbar_edge(win->conf)) {
-        case WINDOW_EDGE_DOWN:
-            edge_y = gtk_widget_get_allocated_height(GTK_WIDGET(win->spice)) - 1.0; break;
-        case WINDOW_EDGE_LEFT:
-            edge_x = 0.0; break;
-        case WINDOW_EDGE_RIGHT:
-            edge_x = gtk_widget_get_allocated_width(GTK_WIDGET(win->spice)) - 1.0; break;
-        default:
-            edge_y = 0.0; break;
-    }
 
     if (win->fullscreen) {
-        if (event->x == edge_x || event->y == edge_y) {
+        if (event->x == win->edge_x || event->y == win->edge_y) {
             gtk_widget_show(GTK_WIDGET(win->revealer));
             gtk_revealer_set_reveal_child(win->revealer, TRUE);
         } else if (gtk_revealer_get_reveal_child(win->revealer)) {
             gtk_revealer_set_reveal_child(win->revealer, FALSE);
-            g_timeout_add(gtk_revealer_get_transition_duration(win->revealer),
-                          hide_widget_cb, win->revealer);
+            client_scheduler_remove(win->scheduler, win->toolbar_timeout_id);
+            win->toolbar_timeout_id = client_scheduler_add(win->scheduler,
+                gtk_revealer_get_transition_duration(win->revealer), hide_toolbar_cb, win);
         }
     }
     user_activity(win);
-    gtk_widget_grab_focus(GTK_WIDGET(win->spice));
+    if (!gtk_widget_is_focus(GTK_WIDGET(win->spice)))
+        gtk_widget_grab_focus(GTK_WIDGET(win->spice));
     return GDK_EVENT_PROPAGATE;
 }
 
 static gboolean spice_win_hide_notification(gpointer user_data) {
     SpiceWindow * win = SPICE_WIN(user_data);
+    if (win->hud) {
+        // Keep the area visible, the overlay takes it back in the next update
+        win->notification_timeout_id = 0;
+        return G_SOURCE_REMOVE;
+    }
     gtk_revealer_set_reveal_child(win->notification_revealer, FALSE);
-    win->notification_timeout_id = g_timeout_add(
+    win->notification_timeout_id = client_scheduler_add(win->scheduler,
         gtk_revealer_get_transition_duration(win->notification_revealer),
-        hide_widget_cb, win->notification_revealer);
+        hide_notification_cb, win);
     return G_SOURCE_REMOVE;
 }
 
@@ -646,12 +686,44 @@ void spice_win_show_notification(SpiceWindow * win, const gchar * text, gint dur
     gtk_widget_show(GTK_WIDGET(win->notification_revealer));
     gtk_revealer_set_reveal_child(win->notification_revealer, TRUE);
     // Cancel previous hide timer
-    if (win->notification_timeout_id) {
-        g_source_remove(win->notification_timeout_id);
+    client_scheduler_remove(win->scheduler, win->notification_timeout_id);
+    win->notification_timeout_id = client_scheduler_add(win->scheduler, duration,
+        spice_win_hide_notification, win);
+}
+
+static gboolean update_perf_hud(gpointer user_data) {
+    SpiceWindow * win = SPICE_WIN(user_data);
+    g_autofree gchar * text = perf_hud_sample(win->hud);
+    // Notifications have priority
+    if (!win->notification_timeout_id)
+        gtk_label_set_text(win->notification, text);
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Show or hide the performance overlay, updated once a second in place of the
+ * notifications.
+ */
+static void toggle_perf_hud(GSimpleAction * action, GVariant * value, gpointer user_data) {
+    SpiceWindow * win = SPICE_WIN(user_data);
+    gboolean show = g_variant_get_boolean(value);
+    g_simple_action_set_state(action, value);
+
+    if (show && !win->hud) {
+        win->hud = perf_hud_new(win->conn, 0);
+        client_scheduler_remove(win->scheduler, win->notification_timeout_id);
         win->notification_timeout_id = 0;
+        gtk_label_set_text(win->notification, "Collecting performance data...");
+        gtk_widget_show(GTK_WIDGET(win->notification_revealer));
+        gtk_revealer_set_reveal_child(win->notification_revealer, TRUE);
+        win->hud_timeout_id = client_scheduler_add(win->scheduler, 1000, update_perf_hud, win);
+    } else if (!show && win->hud) {
+        client_scheduler_remove(win->scheduler, win->hud_timeout_id);
+        win->hud_timeout_id = 0;
+        g_clear_object(&win->hud);
+        client_scheduler_remove(win->scheduler, win->notification_timeout_id);
+        spice_win_hide_notification(win);
     }
-    win->notification_timeout_id = g_timeout_add(duration,
-        spice_win_hide_notification, win);
 }
 
 static gboolean leave_window_cb(GtkWidget * widget, GdkEventCrossing * event,
@@ -789,6 +861,7 @@ typedef struct _ActionAndPrinter {
 static gpointer share_printer_thread(gpointer user_data) {
     ActionAndPrinter * data = (ActionAndPrinter *)user_data;
     flexvdi_share_printer(data->guest_port, data->printer);
+    client_timeline_mark("printer %s shared", data->printer);
     g_idle_add(set_printer_menu_item_sensitive, data->action);
     g_free(data->printer);
     g_free(data);
@@ -853,6 +926,22 @@ static void show_about(GtkToolButton * toolbutton, gpointer user_data) {
     client_show_about(GTK_WINDOW(win), win->conf);
 }
 
+void spice_win_set_reconnecting(SpiceWindow * win, gboolean reconnecting) {
+    if (win->reconnecting == reconnecting) return;
+    win->reconnecting = reconnecting;
+    // Input is not sent while the connection is down
+    gtk_widget_set_sensitive(GTK_WIDGET(win->spice), !reconnecting);
+    if (reconnecting) {
+        spice_win_release_mouse_pointer(win);
+        // Keep the notification until the connection is restored
+        spice_win_show_notification(win, "Connection lost, reconnecting...", G_MAXINT);
+    } else {
+        spice_win_show_notification(win, "Connection restored", 3000);
+        gtk_widget_grab_focus(GTK_WIDGET(win->spice));
+    }
+}
+
+
 void spice_win_release_mouse_pointer(SpiceWindow * win) {
     spice_display_mouse_ungrab(win->spice);
     GdkWindow * window = GDK_WINDOW(gtk_widget_get_window(GTK_WIDGET(win->spice)));
@@ -24,15 +24,17 @@
 #include <spice-client-gtk.h>
 #include "client-conn.h"
 #include "configuration.h"
+#include "client-scheduler.h"
 
 
 #define SPICE_WIN_TYPE (spice_window_get_type())
 G_DECLARE_FINAL_TYPE(SpiceWindow, spice_window, SPICE, WIN, GtkApplicationWindow)
 
-SpiceWindow * spice_window_new(ClientConn * conn, SpiceChannel * channel,
-                               ClientConf * conf, int id, gchar * title);
+SpiceWindow * spice_window_new(ClientConn * conn, ClientConf * conf, ClientScheduler * scheduler,
+                               int id, gchar * title);
 void spice_win_set_cp_sensitive(SpiceWindow * win, gboolean copy, gboolean paste);
 void spice_win_show_notification(SpiceWindow * win, const gchar * text, gint duration);
+void spice_win_set_reconnecting(SpiceWindow * win, gboolean reconnecting);
 void spice_win_release_mouse_pointer(SpiceWindow * win);
 int spice_window_get_monitor(SpiceWindow * win);
 void spice_window_enable_grabbing(SpiceWindow * win, gboolean enable);
@@ -28,6 +28,8 @@
 #include <gio/gio.h>
 
 #include "ws-tunnel.h"
+#include "client-log.h"
+#include "client-timeline.h"
 
 #ifdef G_LOG_DOMAIN
 #undef G_LOG_DOMAIN
@@ -80,7 +82,11 @@ struct _WsTunnel {
     GSocketConnection * local;
     SoupWebsocketConnection * ws_conn;
     GList * in_buffer;
+    gsize in_buffer_size;
     GCancellable * cancel;
+    gint64 start;
+    gint64 connecting, rtt;
+    GSocket * socket;
 };
 
 enum {
@@ -148,6 +154,7 @@ static void ws_tunnel_dispose(GObject * obj) {
     g_clear_object(&tunnel->channel);
     g_clear_object(&tunnel->local);
     g_clear_object(&tunnel->ws_conn);
+    g_clear_object(&tunnel->socket);
     g_list_free_full(tunnel->in_buffer, (GDestroyNotify)g_bytes_unref);
     g_clear_object(&tunnel->cancel);
     G_OBJECT_CLASS(ws_tunnel_parent_class)->finalize(obj);
@@ -169,16 +176,42 @@ static void ws_tunnel_finalize(GObject * obj) {
 static void ws_tunnel_connect(GObject *source_object, GAsyncResult * res,
                               gpointer user_data);
 
+/*
+ * The TCP handshake takes one round trip. Keep the socket, the kernel measures
+ * the round trip time of the link for as long as it is open.
+ */
+static void network_event_cb(SoupMessage * msg, GSocketClientEvent event,
+                             GIOStream * connection, gpointer user_data) {
+    WsTunnel * tunnel = WS_TUNNEL(user_data);
+    switch (event) {
+        case G_SOCKET_CLIENT_CONNECTING: tunnel->connecting = g_get_monotonic_time(); break;
+        case G_SOCKET_CLIENT_CONNECTED:
+            if (tunnel->connecting)
+                tunnel->rtt = g_get_monotonic_time() - tunnel->connecting;
+            if (G_IS_SOCKET_CONNECTION(connection)) {
+                g_clear_object(&tunnel->socket);
+                tunnel->socket = g_object_ref(
+                    g_socket_connection_get_socket(G_SOCKET_CONNECTION(connection)));
+            }
+            break;
+        default:;
+    }
+}
+
+
 WsTunnel * ws_tunnel_new(SpiceChannel * channel, SoupSession * soup, gchar * ws_uri) {
     int id, type;
 
     g_object_get(channel, "channel-id", &id, "channel-type", &type, NULL);
     WsTunnel * tunnel = WS_TUNNEL(g_object_new(WS_TUNNEL_TYPE, NULL));
     tunnel->channel_name = g_strdup_printf("%d:%d", type, id);
+    tunnel->start = g_get_monotonic_time();
+    tunnel->rtt = -1;
 
     if (tunnel->fd != 0) {
         tunnel->channel = g_object_ref(channel);
         tunnel->msg = soup_message_new("GET", ws_uri);
+        g_signal_connect(tunnel->msg, "network-event", G_CALLBACK(network_event_cb), tunnel);
         soup_session_websocket_connect_async(
             soup, tunnel->msg, NULL, NULL, NULL,
             ws_tunnel_connect, tunnel);
@@ -200,6 +233,21 @@ gboolean ws_tunnel_is_channel(WsTunnel * tunnel, SpiceChannel * channel) {
 }
 
 
+gint64 ws_tunnel_get_rtt(WsTunnel * tunnel) {
+    return tunnel->rtt;
+}
+
+
+gsize ws_tunnel_get_queued_bytes(WsTunnel * tunnel) {
+    return tunnel->in_buffer_size;
+}
+
+
+GSocket * ws_tunnel_get_socket(WsTunnel * tunnel) {
+    return tunnel->socket;
+}
+
+
 static void on_ws_error(SoupWebsocketConnection * self, GError * error, gpointer user_data);
 static void on_ws_msg(SoupWebsocketConnection * self, gint type,
                       GBytes * message, gpointer user_data);
@@ -237,6 +285,7 @@ static void ws_tunnel_connect(GObject *source_object, GAsyncResult * res,
     }
 
     g_debug("WS tunnel %s connected", tunnel->channel_name);
+    client_timeline_span(tunnel->start, "WS tunnel %s connected", tunnel->channel_name);
 
     // Get a second extra ref. They are released when we read and write
     // for the last time on the local socket.
@@ -273,7 +322,7 @@ static void read_local_finished(GObject * source_object, GAsyncResult * res,
                     tunnel->channel_name);
                 g_signal_emit(tunnel, signals[WS_TUNNEL_EOF], 0);
             } else {
-                g_debug("WS tunnel %s read %d bytes from local",
+                CLIENT_DEBUG("WS tunnel %s read %d bytes from local",
                     tunnel->channel_name, (int)g_bytes_get_size(bytes));
                 soup_websocket_connection_send_binary(tunnel->ws_conn,
                     g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
@@ -300,9 +349,10 @@ static void on_ws_msg(SoupWebsocketConnection * self, gint type,
                       GBytes * message, gpointer user_data) {
     WsTunnel * tunnel = WS_TUNNEL(user_data);
     if (!g_cancellable_is_cancelled(tunnel->cancel)) {
-        g_debug("WS tunnel %s read %d bytes from ws", tunnel->channel_name,
+        CLIENT_DEBUG("WS tunnel %s read %d bytes from ws", tunnel->channel_name,
             (int)g_bytes_get_size(message));
         tunnel->in_buffer = g_list_append(tunnel->in_buffer, g_bytes_ref(message));
+        tunnel->in_buffer_size += g_bytes_get_size(message);
         if (g_list_length(tunnel->in_buffer) == 1)
             next_local_write(tunnel);
     }
@@ -340,6 +390,7 @@ static void write_local_finished(GObject * source_object, GAsyncResult * res,
         } else {
             GBytes * bytes = (GBytes *)tunnel->in_buffer->data;
             gsize bsize = g_bytes_get_size(bytes);
+            tunnel->in_buffer_size -= MIN(size, bsize);
 
             if (size < bsize) {
                 tunnel->in_buffer->data = g_bytes_new_from_bytes(bytes, size, bsize - size);
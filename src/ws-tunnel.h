@@ -56,4 +56,29 @@ void ws_tunnel_unref(WsTunnel * tunnel);
  */
 gboolean ws_tunnel_is_channel(WsTunnel * tunnel, SpiceChannel * channel);
 
+/*
+ * ws_tunnel_get_rtt
+ *
+ * Get the round-trip time to the WebSocket server, measured once during the TCP
+ * handshake, in microseconds. Return -1 if it is not known, e.g. because the
+ * connection was reused. It does not follow the load of the link.
+ */
+gint64 ws_tunnel_get_rtt(WsTunnel * tunnel);
+
+/*
+ * ws_tunnel_get_queued_bytes
+ *
+ * Get the number of bytes received from the WebSocket that are waiting to be
+ * read by the spice channel. They pile up when the channel consumes them slower
+ * than they arrive, e.g. on a busy CPU, not when the link is saturated.
+ */
+gsize ws_tunnel_get_queued_bytes(WsTunnel * tunnel);
+
+/*
+ * ws_tunnel_get_socket
+ *
+ * Get the TCP socket to the WebSocket server, or NULL if it is not connected yet.
+ */
+GSocket * ws_tunnel_get_socket(WsTunnel * tunnel);
+
 #endif /* _WS_TUNNEL_H */
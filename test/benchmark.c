@@ -0,0 +1,476 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * flexvdi-benchmark: connects to a Spice URI without any GTK window, decodes the
+ * display channels into offscreen buffers for a fixed time and prints a report.
+ *
+ * With --latency, it also injects key or mouse events every PROBE_INTERVAL ms and
+ * measures the time until the pixels of the given area of the first display change,
+ * e.g. with an echoed character or a marker drawn by a test guest. Updates that
+ * leave the area as it was when the probe was sent (cursor blinks, redraws) do
+ * not answer a probe.
+ *
+ * Usage: flexvdi-benchmark [-d seconds] [-l probes --area x,y,w,h] spice://host:port
+ *        flexvdi-benchmark [-d seconds] [-l probes --area x,y,w,h] --ws token manager-host
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <spice-client.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "src/configuration.h"
+#include "src/client-conn.h"
+
+
+typedef struct Surface {
+    guint8 * source;
+    guint8 * pixels;
+    gint width, height, stride, bpp;
+} Surface;
+
+#define PROBE_INTERVAL 500
+#define PROBE_TIMEOUT (2 * G_USEC_PER_SEC)
+// Wait for the desktop to settle before the first probe
+#define PROBE_DELAY 2
+// Scancodes of 'a' and Backspace, so that echoed text does not grow
+#define PROBE_KEY 0x1e
+#define PROBE_UNDO_KEY 0x0e
+
+typedef struct Benchmark {
+    GMainLoop * loop;
+    ClientConn * conn;
+    GPtrArray * channels;
+    gint64 start, end;
+    guint frames;
+    guint updates;
+    guint64 pixels;
+    gboolean dirty;
+    gint64 poll_return;
+    GArray * frame_times;
+    GPollFunc default_poll;
+    // Latency probes
+    SpiceMainChannel * main;
+    SpiceInputsChannel * inputs;
+    gboolean probe_mouse;
+    gint area_x, area_y, area_w, area_h;
+    guint probes, probes_sent, probes_lost;
+    gint64 probe_sent;
+    // Surface of display 0, and its probe area when the last probe was sent
+    Surface * probe_surface;
+    guint8 * snapshot;
+    gsize snapshot_size;
+    GArray * latencies;
+} Benchmark;
+
+static Benchmark bench;
+
+
+static void primary_create(SpiceChannel * channel, gint format, gint width, gint height,
+                           gint stride, gint shmid, gpointer imgdata, gpointer data) {
+    Surface * surface = data;
+    g_free(surface->pixels);
+    surface->source = imgdata;
+    surface->width = width;
+    surface->height = height;
+    surface->stride = stride;
+    surface->bpp = format == SPICE_SURFACE_FMT_16_555 ||
+                   format == SPICE_SURFACE_FMT_16_565 ? 2 : 4;
+    surface->pixels = g_malloc((gsize)stride * height);
+    memcpy(surface->pixels, surface->source, (gsize)stride * height);
+}
+
+
+static void surface_free(gpointer data) {
+    Surface * surface = data;
+    g_free(surface->pixels);
+    g_free(surface);
+}
+
+
+static void primary_destroy(SpiceChannel * channel, gpointer data) {
+    Surface * surface = data;
+    g_clear_pointer(&surface->pixels, g_free);
+    surface->source = NULL;
+}
+
+
+static gboolean stop_benchmark(gpointer data);
+
+
+static gboolean in_probe_area(gint x, gint y, gint w, gint h) {
+    return x < bench.area_x + bench.area_w && bench.area_x < x + w &&
+           y < bench.area_y + bench.area_h && bench.area_y < y + h;
+}
+
+
+/*
+ * Clip the probe area to the surface. Returns FALSE if they do not overlap.
+ */
+static gboolean get_probe_rect(Surface * surface, gint * x, gint * y, gint * w, gint * h) {
+    *x = CLAMP(bench.area_x, 0, surface->width);
+    *y = CLAMP(bench.area_y, 0, surface->height);
+    *w = MIN(bench.area_x + bench.area_w, surface->width) - *x;
+    *h = MIN(bench.area_y + bench.area_h, surface->height) - *y;
+    return *w > 0 && *h > 0;
+}
+
+
+/*
+ * Copy the probe area of the offscreen buffer to the snapshot, or compare them
+ * if copy is FALSE. Returns whether the area is equal to the snapshot.
+ */
+static gboolean probe_area_snapshot(Surface * surface, gboolean copy) {
+    gint x, y, w, h, row;
+    gsize row_size;
+
+    if (!surface->pixels || !get_probe_rect(surface, &x, &y, &w, &h))
+        return FALSE;
+    row_size = (gsize)w * surface->bpp;
+    if (copy) {
+        bench.snapshot_size = row_size * h;
+        bench.snapshot = g_realloc(bench.snapshot, bench.snapshot_size);
+    } else if (bench.snapshot_size != row_size * h)
+        // The surface was resized
+        return FALSE;
+    for (row = 0; row < h; ++row) {
+        guint8 * pixels = surface->pixels + (gsize)(y + row) * surface->stride +
+                          (gsize)x * surface->bpp;
+        guint8 * snapshot = bench.snapshot + row_size * row;
+        if (copy)
+            memcpy(snapshot, pixels, row_size);
+        else if (memcmp(snapshot, pixels, row_size))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+/*
+ * Copy the invalidated area to the offscreen buffer, as a window would when
+ * it blits the primary surface to the screen.
+ */
+static void invalidate(SpiceChannel * channel, gint x, gint y, gint w, gint h,
+                       gpointer data) {
+    Surface * surface = data;
+    gint row;
+
+    if (!surface->pixels || bench.end) return;
+    x = CLAMP(x, 0, surface->width);
+    y = CLAMP(y, 0, surface->height);
+    w = MIN(w, surface->width - x);
+    h = MIN(h, surface->height - y);
+    for (row = y; row < y + h; ++row) {
+        gsize offset = (gsize)row * surface->stride + (gsize)x * surface->bpp;
+        memcpy(surface->pixels + offset, surface->source + offset, (gsize)w * surface->bpp);
+    }
+    bench.updates++;
+    bench.pixels += (guint64)w * h;
+    bench.dirty = TRUE;
+
+    if (bench.probe_sent && surface == bench.probe_surface && in_probe_area(x, y, w, h) &&
+        !probe_area_snapshot(surface, FALSE)) {
+        gint64 latency = g_get_monotonic_time() - bench.probe_sent;
+        g_array_append_val(bench.latencies, latency);
+        bench.probe_sent = 0;
+        if (bench.probes_sent == bench.probes)
+            g_idle_add(stop_benchmark, NULL);
+    }
+}
+
+
+static void channel_new(SpiceSession * session, SpiceChannel * channel, gpointer data) {
+    Surface * surface;
+    gint id;
+
+    if (SPICE_IS_MAIN_CHANNEL(channel))
+        bench.main = SPICE_MAIN_CHANNEL(channel);
+    // Without a SpiceDisplay widget, nobody else connects the inputs channel
+    if (SPICE_IS_INPUTS_CHANNEL(channel) && bench.probes) {
+        bench.inputs = SPICE_INPUTS_CHANNEL(channel);
+        spice_channel_connect(channel);
+    }
+    if (!SPICE_IS_DISPLAY_CHANNEL(channel)) return;
+    surface = g_new0(Surface, 1);
+    g_object_set_data_full(G_OBJECT(channel), "benchmark-surface", surface, surface_free);
+    g_signal_connect(channel, "display-primary-create", G_CALLBACK(primary_create), surface);
+    g_signal_connect(channel, "display-primary-destroy", G_CALLBACK(primary_destroy), surface);
+    g_signal_connect(channel, "display-invalidate", G_CALLBACK(invalidate), surface);
+    g_object_get(channel, "channel-id", &id, NULL);
+    if (id == 0)
+        bench.probe_surface = surface;
+    g_ptr_array_add(bench.channels, g_object_ref(channel));
+}
+
+
+/*
+ * Measure the work done by each main loop iteration: the time between poll()
+ * returning and the next call to poll(). Spice channels decode in coroutines on
+ * this thread, so an iteration that invalidated some area is one decoded frame.
+ */
+static gint benchmark_poll(GPollFD * fds, guint nfds, gint timeout) {
+    gint64 now = g_get_monotonic_time();
+    gint result;
+
+    if (bench.poll_return && bench.dirty) {
+        gint64 work = now - bench.poll_return;
+        g_array_append_val(bench.frame_times, work);
+        bench.frames++;
+    }
+    bench.dirty = FALSE;
+    result = bench.default_poll(fds, nfds, timeout);
+    bench.poll_return = g_get_monotonic_time();
+    return result;
+}
+
+
+/*
+ * Inject the next probe event. Even probes type a key or move the pointer right,
+ * odd probes undo it, so that the guest keeps changing the same area.
+ */
+static gboolean send_probe(gpointer data) {
+    gboolean undo = bench.probes_sent % 2;
+    gint mouse_mode = 0;
+
+    if (bench.end) return G_SOURCE_REMOVE;
+    if (bench.probe_sent) {
+        if (g_get_monotonic_time() - bench.probe_sent < PROBE_TIMEOUT)
+            return G_SOURCE_CONTINUE;
+        bench.probes_lost++;
+        bench.probe_sent = 0;
+    }
+    if (bench.probes_sent == bench.probes) {
+        stop_benchmark(NULL);
+        return G_SOURCE_REMOVE;
+    }
+    if (!bench.inputs || bench.frames == 0 || !bench.probe_surface ||
+        !bench.probe_surface->pixels)
+        return G_SOURCE_CONTINUE;
+    if (!probe_area_snapshot(bench.probe_surface, TRUE)) {
+        g_printerr("The probe area is outside the display\n");
+        stop_benchmark(NULL);
+        return G_SOURCE_REMOVE;
+    }
+
+    bench.probes_sent++;
+    bench.probe_sent = g_get_monotonic_time();
+    if (bench.probe_mouse) {
+        if (bench.main)
+            g_object_get(bench.main, "mouse-mode", &mouse_mode, NULL);
+        if (mouse_mode == SPICE_MOUSE_MODE_CLIENT)
+            spice_inputs_channel_position(bench.inputs, bench.area_x + (undo ? 0 : 8),
+                                          bench.area_y, 0, 0);
+        else
+            spice_inputs_channel_motion(bench.inputs, undo ? -8 : 8, 0, 0);
+    } else {
+        guint scancode = undo ? PROBE_UNDO_KEY : PROBE_KEY;
+        spice_inputs_channel_key_press(bench.inputs, scancode);
+        spice_inputs_channel_key_release(bench.inputs, scancode);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean start_probes(gpointer data) {
+    g_timeout_add(PROBE_INTERVAL, send_probe, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean stop_benchmark(gpointer data) {
+    if (bench.end) return G_SOURCE_REMOVE;
+    bench.end = g_get_monotonic_time();
+    client_conn_disconnect(bench.conn, CLIENT_CONN_DISCONNECT_USER);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void disconnected(ClientConn * conn, ClientConnDisconnectReason reason,
+                         gpointer data) {
+    if (!bench.end) {
+        bench.end = g_get_monotonic_time();
+        g_printerr("Connection closed before the end of the benchmark (reason %d)\n", reason);
+    }
+    g_main_loop_quit(bench.loop);
+}
+
+
+static guint64 get_peak_rss(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (guint64)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+
+static gint compare_times(gconstpointer a, gconstpointer b) {
+    gint64 ta = *(const gint64 *)a, tb = *(const gint64 *)b;
+    return ta < tb ? -1 : ta > tb;
+}
+
+
+static double percentile(GArray * sorted, double p) {
+    guint index;
+    if (sorted->len == 0) return 0.0;
+    index = (guint)(p / 100.0 * (sorted->len - 1) + 0.5);
+    return g_array_index(sorted, gint64, index) / 1000.0;
+}
+
+
+static void print_times(const gchar * title, GArray * times) {
+    g_array_sort(times, compare_times);
+    printf("%s p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", title,
+           percentile(times, 50), percentile(times, 90),
+           percentile(times, 99), percentile(times, 100));
+}
+
+
+static void print_report(void) {
+    double seconds = (bench.end - bench.start) / (double)G_USEC_PER_SEC;
+    guint64 bytes = 0;
+    guint i;
+
+    for (i = 0; i < bench.channels->len; ++i) {
+        gulong read_bytes = 0;
+        g_object_get(g_ptr_array_index(bench.channels, i), "total-read-bytes", &read_bytes, NULL);
+        bytes += read_bytes;
+    }
+
+    printf("Duration:          %.2f s\n", seconds);
+    printf("Display channels:  %u\n", bench.channels->len);
+    printf("Frames decoded:    %u (%.1f fps)\n", bench.frames,
+           seconds > 0 ? bench.frames / seconds : 0.0);
+    printf("Display updates:   %u (%.1f Mpixel)\n", bench.updates, bench.pixels / 1e6);
+    printf("Bytes received:    %" G_GUINT64_FORMAT " (%.1f KB/s)\n", bytes,
+           seconds > 0 ? bytes / 1024.0 / seconds : 0.0);
+    print_times("Decode time (ms): ", bench.frame_times);
+    printf("Peak RSS:          %.1f MB\n", get_peak_rss() / 1048576.0);
+    if (bench.probes) {
+        printf("Latency probes:    %u sent, %u answered, %u lost\n", bench.probes_sent,
+               bench.latencies->len, bench.probes_lost);
+        print_times("Latency (ms):     ", bench.latencies);
+    }
+}
+
+
+int main(int argc, char * argv[]) {
+    gint duration = 30, probes = 0;
+    gchar * probe = NULL, * area = NULL, * ws_token = NULL, * password = NULL;
+    GOptionEntry options[] = {
+        { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+          "Benchmark duration in seconds (default 30)", "<seconds>" },
+        { "latency", 'l', 0, G_OPTION_ARG_INT, &probes,
+          "Measure input latency with this many probes", "<probes>" },
+        { "probe", 0, 0, G_OPTION_ARG_STRING, &probe,
+          "Probe with key presses or mouse motion (default key)", "key|mouse" },
+        { "area", 0, 0, G_OPTION_ARG_STRING, &area,
+          "Area that changes when the guest answers a probe, required with --latency",
+          "<x,y,w,h>" },
+        { "ws", 0, 0, G_OPTION_ARG_STRING, &ws_token,
+          "Connect to the manager host through a WebSocket tunnel with this token", "<token>" },
+        { "password", 0, 0, G_OPTION_ARG_STRING, &password,
+          "Spice password, with --ws", "<password>" },
+        { NULL }
+    };
+    GOptionContext * context = g_option_context_new("<spice URI>");
+    GError * error = NULL;
+    ClientConf * conf;
+
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 2 || duration <= 0 ||
+        probes < 0 || (probe && g_strcmp0(probe, "key") && g_strcmp0(probe, "mouse")) ||
+        (area && sscanf(area, "%d,%d,%d,%d", &bench.area_x, &bench.area_y,
+                        &bench.area_w, &bench.area_h) != 4) ||
+        (probes > 0 && (bench.area_w <= 0 || bench.area_h <= 0))) {
+        g_printerr("%s\n", error ? error->message :
+                   "Usage: flexvdi-benchmark [options] <spice URI | manager host with --ws>");
+        g_clear_error(&error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+    bench.probes = probes;
+    bench.probe_mouse = !g_strcmp0(probe, "mouse");
+
+    bench.loop = g_main_loop_new(NULL, FALSE);
+    bench.channels = g_ptr_array_new_with_free_func(g_object_unref);
+    bench.frame_times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    bench.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    bench.default_poll = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, benchmark_poll);
+
+    conf = client_conf_new();
+    if (ws_token) {
+        // Same parameters as a desktop response from the manager
+        JsonObject * params = json_object_new();
+        json_object_set_string_member(params, "spice_address", argv[1]);
+        json_object_set_string_member(params, "spice_port", ws_token);
+        json_object_set_string_member(params, "spice_password", password);
+        json_object_set_boolean_member(params, "use_ws", TRUE);
+        bench.conn = client_conn_new(conf, NULL, params);
+        json_object_unref(params);
+    } else {
+        bench.conn = client_conn_new_with_uri(conf, NULL, argv[1]);
+    }
+    g_signal_connect(client_conn_get_session(bench.conn), "channel-new",
+                     G_CALLBACK(channel_new), NULL);
+    g_signal_connect(bench.conn, "disconnected", G_CALLBACK(disconnected), NULL);
+
+    bench.start = g_get_monotonic_time();
+    client_conn_connect(bench.conn);
+    g_timeout_add_seconds(duration, stop_benchmark, NULL);
+    if (bench.probes)
+        g_timeout_add_seconds(PROBE_DELAY, start_probes, NULL);
+    g_main_loop_run(bench.loop);
+
+    print_report();
+
+    g_main_context_set_poll_func(NULL, bench.default_poll);
+    g_ptr_array_free(bench.channels, TRUE);
+    g_array_free(bench.frame_times, TRUE);
+    g_array_free(bench.latencies, TRUE);
+    g_free(bench.snapshot);
+    g_object_unref(bench.conn);
+    g_object_unref(conf);
+    g_main_loop_unref(bench.loop);
+    g_free(probe);
+    g_free(area);
+    g_free(ws_token);
+    g_free(password);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MOCK_MANAGER_H
+#define _MOCK_MANAGER_H
+
+#include <glib-object.h>
+#include "src/configuration.h"
+
+
+/*
+ * MockManager
+ *
+ * An in-process stand-in for the flexVDI Manager, for tests and benchmarks. It
+ * listens with HTTPS on a random local port of the default main context, and
+ * implements:
+ * - /vdi/authmode: always answers with the active_directory mode.
+ * - /vdi/desktop: answers "Pending" a configurable number of times, then "OK"
+ *   with the parameters of a WebSocket connection to this same server.
+ * - A WebSocket endpoint on "/", which echoes every message.
+ * - /get, /post and /html, which mimic the httpbin.org endpoints used by the tests.
+ */
+#define MOCK_MANAGER_TYPE (mock_manager_get_type())
+G_DECLARE_FINAL_TYPE(MockManager, mock_manager, MOCK, MANAGER, GObject)
+
+/*
+ * mock_manager_new
+ *
+ * Create a new MockManager, listening on a random port.
+ */
+MockManager * mock_manager_new(void);
+
+/*
+ * mock_manager_get_port
+ *
+ * The port the manager is listening on.
+ */
+guint mock_manager_get_port(MockManager * manager);
+
+/*
+ * mock_manager_configure
+ *
+ * Point a ClientConf object to this manager.
+ */
+void mock_manager_configure(MockManager * manager, ClientConf * conf);
+
+/*
+ * mock_manager_set_pending
+ *
+ * Number of "Pending" responses to each /vdi/desktop request before answering "OK".
+ */
+void mock_manager_set_pending(MockManager * manager, guint pending);
+
+/*
+ * mock_manager_get_requests
+ *
+ * Number of requests received on a path.
+ */
+guint mock_manager_get_requests(MockManager * manager, const gchar * path);
+
+#endif /* _MOCK_MANAGER_H */
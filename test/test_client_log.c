@@ -17,7 +17,13 @@
     along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
 #include "src/client-log.h"
 
 
@@ -40,15 +46,209 @@ void test_client_log() {
     g_assert_true(client_log_get_level_for_domain("bar") == G_LOG_LEVEL_WARNING);
     g_assert_true(client_log_get_level_for_domain("baz") == G_LOG_LEVEL_MESSAGE);
     g_assert_true(g_getenv("SPICE_DEBUG") == NULL);
+    g_assert_true(client_log_is_enabled("foo", G_LOG_LEVEL_INFO));
+    g_assert_false(client_log_is_enabled("foo", G_LOG_LEVEL_DEBUG));
+    g_assert_true(client_log_is_enabled("bar", G_LOG_LEVEL_WARNING));
+    g_assert_false(client_log_is_enabled("bar", G_LOG_LEVEL_MESSAGE));
+    g_assert_true(client_log_is_enabled("baz", G_LOG_LEVEL_MESSAGE));
+    g_assert_false(client_log_is_enabled("baz", G_LOG_LEVEL_INFO));
+    g_assert_true(client_log_is_enabled(NULL, G_LOG_LEVEL_MESSAGE));
 
     client_log_set_log_levels("GSpice:5");
     g_assert_cmpstr(g_getenv("SPICE_DEBUG"), ==, "1");
 }
 
+static int evaluated = 0;
+
+static int evaluate() {
+    return ++evaluated;
+}
+
+void test_client_log_debug() {
+    // Test that debug-only arguments are not evaluated when debug is disabled
+
+    client_log_set_log_levels("4");
+    g_assert_false(client_log_debug_enabled());
+    CLIENT_DEBUG("Evaluated %d", evaluate());
+    g_assert_cmpint(evaluated, ==, 0);
+
+    client_log_set_log_levels("5");
+    g_assert_true(client_log_debug_enabled());
+    CLIENT_DEBUG("Evaluated %d", evaluate());
+    g_assert_cmpint(evaluated, ==, 1);
+}
+
+static gchar * read_log(const gchar * path, gboolean compressed) {
+    g_autoptr(GFile) file = g_file_new_for_path(path);
+    g_autoptr(GInputStream) in = G_INPUT_STREAM(g_file_read(file, NULL, NULL));
+    g_assert_nonnull(in);
+    if (compressed) {
+        g_autoptr(GZlibDecompressor) decompressor =
+            g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+        GInputStream * gz = g_converter_input_stream_new(in, G_CONVERTER(decompressor));
+        g_object_unref(in);
+        in = gz;
+    }
+    g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable();
+    g_assert_cmpint(g_output_stream_splice(out, in, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                           NULL, NULL), >=, 0);
+    g_output_stream_write(out, "", 1, NULL, NULL);
+    return g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(out));
+}
+
+// Check that the records of a log file are consecutive, return the first one
+static int check_records(const gchar * contents, int * last) {
+    gchar ** lines = g_strsplit(contents, "\n", 0);
+    int i, first = -1;
+    for (i = 0; lines[i]; ++i) {
+        const gchar * record = strstr(lines[i], "record ");
+        if (record) {
+            int n = atoi(record + 7);
+            if (first < 0) first = n;
+            else g_assert_cmpint(n, ==, *last + 1);
+            *last = n;
+        }
+    }
+    g_strfreev(lines);
+    return first;
+}
+
+void test_client_log_writer() {
+    // Test that queued messages reach the log file in order, and that it is rotated
+
+    // Logging to a file redirects stdout, where the test output goes
+    if (g_test_subprocess()) {
+        g_autofree gchar * dir = g_dir_make_tmp("flexvdi-log-XXXXXX", NULL);
+        g_autofree gchar * file_path = g_build_filename(dir, "test.log", NULL);
+        g_autofree gchar * archive1 = g_strdup_printf("%s.1.gz", file_path);
+        g_autofree gchar * archive2 = g_strdup_printf("%s.2.gz", file_path);
+        g_autofree gchar * archive3 = g_strdup_printf("%s.3.gz", file_path);
+        g_setenv("FLEXVDI_LOG_FILE", file_path, TRUE);
+        g_setenv("FLEXVDI_LOG_MAX_SIZE", "64", TRUE);
+        g_setenv("FLEXVDI_LOG_ARCHIVES", "2", TRUE);
+        client_log_setup();
+        client_log_set_log_levels("4");
+
+        int i;
+        for (i = 0; i < 10000; ++i)
+            g_info("record %d", i);
+        client_log_flush();
+
+        g_autofree gchar * contents = read_log(file_path, FALSE);
+        int last = -1, first = check_records(contents, &last);
+        g_assert_cmpint(last, ==, 9999);
+        g_assert_cmpint(first, >, 0);
+
+        // Nothing is lost when rotating
+        g_autofree gchar * archived = read_log(archive1, TRUE);
+        int archived_last = -1;
+        check_records(archived, &archived_last);
+        g_assert_cmpint(archived_last, ==, first - 1);
+        g_assert_true(g_file_test(archive2, G_FILE_TEST_EXISTS));
+        g_assert_false(g_file_test(archive3, G_FILE_TEST_EXISTS));
+
+        g_unlink(file_path);
+        g_unlink(archive1);
+        g_unlink(archive2);
+        g_rmdir(dir);
+        return;
+    }
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+}
+
+static gpointer log_debug_records(gpointer data) {
+    int i;
+    for (i = 0; i < 5000; ++i)
+        g_debug("thread %d debug record %d, padded to make the log grow faster: %0100d",
+                GPOINTER_TO_INT(data), i, 0);
+    return NULL;
+}
+
+// Check that every line of a log file is a JSON object, return the dropped notices
+static int check_json_lines(const gchar * contents) {
+    gchar ** lines = g_strsplit(contents, "\n", 0);
+    int i, notices = 0;
+    for (i = 0; lines[i]; ++i) {
+        if (lines[i][0] == '\0') continue;
+        g_autoptr(JsonParser) parser = json_parser_new();
+        g_assert_true(json_parser_load_from_data(parser, lines[i], -1, NULL));
+        JsonObject * record = json_node_get_object(json_parser_get_root(parser));
+        g_assert_nonnull(record);
+        g_assert_true(json_object_has_member(record, "time"));
+        g_assert_true(json_object_has_member(record, "mono"));
+        g_assert_true(json_object_has_member(record, "thread"));
+        if (g_str_has_suffix(json_object_get_string_member(record, "message"),
+                             "debug messages dropped")) {
+            g_assert_cmpstr(json_object_get_string_member(record, "level"), ==, "WARNING");
+            ++notices;
+        }
+    }
+    g_strfreev(lines);
+    return notices;
+}
+
+void test_client_log_json() {
+    // Test that the log is still JSON lines when debug records are dropped
+
+    if (g_test_subprocess()) {
+        g_autofree gchar * dir = g_dir_make_tmp("flexvdi-log-XXXXXX", NULL);
+        g_autofree gchar * file_path = g_build_filename(dir, "test.log", NULL);
+        GThread * threads[4];
+        int i, notices;
+        g_setenv("FLEXVDI_LOG_FILE", file_path, TRUE);
+        // Rotate a few times, but keep every archive to find the notice in
+        g_setenv("FLEXVDI_LOG_MAX_SIZE", "256", TRUE);
+        g_setenv("FLEXVDI_LOG_ARCHIVES", "16", TRUE);
+        g_setenv("FLEXVDI_LOG_FORMAT", "json", TRUE);
+        client_log_setup();
+        client_log_set_log_levels("5");
+
+        // Stall the writer on the log file lock, so that the ring fills up
+#ifdef _WIN32
+        _lock_file(stderr);
+#else
+        flockfile(stderr);
+#endif
+        for (i = 0; i < G_N_ELEMENTS(threads); ++i)
+            threads[i] = g_thread_new("logger", log_debug_records, GINT_TO_POINTER(i));
+        for (i = 0; i < G_N_ELEMENTS(threads); ++i)
+            g_thread_join(threads[i]);
+#ifdef _WIN32
+        _unlock_file(stderr);
+#else
+        funlockfile(stderr);
+#endif
+        // The dropped notice goes with the next batch
+        g_message("last record");
+        client_log_flush();
+
+        g_autofree gchar * contents = read_log(file_path, FALSE);
+        notices = check_json_lines(contents);
+        g_unlink(file_path);
+        for (i = 1; i <= 16; ++i) {
+            g_autofree gchar * archive = g_strdup_printf("%s.%d.gz", file_path, i);
+            if (g_file_test(archive, G_FILE_TEST_EXISTS)) {
+                g_autofree gchar * archived = read_log(archive, TRUE);
+                notices += check_json_lines(archived);
+                g_unlink(archive);
+            }
+        }
+        g_assert_cmpint(notices, >, 0);
+        g_rmdir(dir);
+        return;
+    }
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+}
+
 int main(int argc, char * argv[]) {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/misc/client_log", test_client_log);
+    g_test_add_func("/misc/client_log_debug", test_client_log_debug);
+    g_test_add_func("/misc/client_log_writer", test_client_log_writer);
+    g_test_add_func("/misc/client_log_json", test_client_log_json);
 
     return g_test_run();
 }
@@ -17,13 +17,16 @@
     along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
 #include <glib.h>
 #include "src/client-log.h"
 #include "src/client-request.h"
+#include "mock-manager.h"
 
 
 typedef struct _Fixture {
     GMainLoop * loop;
+    MockManager * manager;
     ClientConf * conf;
     ClientRequest * req;
     GError * error;
@@ -33,16 +36,19 @@ typedef struct _Fixture {
 static void f_setup(Fixture * f, gconstpointer user_data) {
     f->loop = g_main_loop_new(NULL, FALSE);
     f->conf = client_conf_new();
-    // Use a generic JSON web service to test requests
-    client_conf_set_host(f->conf, "httpbin.org");
+    // Use a local stand-in for the manager to test requests
+    f->manager = mock_manager_new();
+    mock_manager_configure(f->manager, f->conf);
+    f->req = NULL;
     f->error = NULL;
 }
 
 static void f_teardown(Fixture * f, gconstpointer user_data) {
     if (f->error)
         g_error_free(f->error);
-    g_object_unref(f->req);
+    g_clear_object(&f->req);
     g_object_unref(f->conf);
+    g_object_unref(f->manager);
     g_main_loop_unref(f->loop);
 }
 
@@ -67,12 +73,22 @@ static void test_client_request_get(Fixture *f, gconstpointer user_data) {
     JsonObject * response = json_node_get_object(f->resp);
     g_assert_true(json_object_has_member(response, "url"));
     const gchar * url = json_object_get_string_member(response, "url");
-    g_assert_cmpstr(url, ==, "https://httpbin.org/get");
+    g_autofree gchar * expected = g_strdup_printf("https://127.0.0.1:%u/get",
+                                                  mock_manager_get_port(f->manager));
+    g_assert_cmpstr(url, ==, expected);
+
+    const ClientRequestTimings * t = client_request_get_timings(f->req);
+    g_assert_cmpint(t->start, >, 0);
+    g_assert_cmpint(t->tls, >=, t->start);
+    g_assert_cmpint(t->request_sent, >=, t->tls);
+    g_assert_cmpint(t->first_byte, >=, t->request_sent);
+    g_assert_cmpint(t->body_complete, >=, t->first_byte);
+    g_assert_cmpint(t->parse_complete, >=, t->body_complete);
 }
 
 
 static void test_client_request_get_fail(Fixture *f, gconstpointer user_data) {
-    f->req = client_request_new(f->conf, "/", request_result, f);
+    f->req = client_request_new(f->conf, "/html", request_result, f);
 
     g_main_loop_run(f->loop);
 
@@ -95,13 +111,163 @@ static void test_client_request_post(Fixture *f, gconstpointer user_data) {
 }
 
 
+static void test_client_request_authmode(Fixture *f, gconstpointer user_data) {
+    f->req = client_request_new_with_data(f->conf, "/vdi/authmode",
+        "{\"hwaddress\": \"00:11:22:33:44:55\"}", request_result, f);
+
+    g_main_loop_run(f->loop);
+
+    g_assert_no_error(f->error);
+    JsonObject * response = json_node_get_object(f->resp);
+    g_assert_cmpstr(json_object_get_string_member(response, "status"), ==, "OK");
+    g_assert_cmpstr(json_object_get_string_member(response, "auth_mode"), ==, "active_directory");
+}
+
+
+static void test_client_request_failover(Fixture *f, gconstpointer user_data) {
+    // Nothing listens on port 1, so the request fails over to the mock manager
+    g_autofree gchar * hosts = g_strdup_printf("127.0.0.1:1, 127.0.0.1:%u",
+                                               mock_manager_get_port(f->manager));
+    client_conf_set_host(f->conf, hosts);
+    f->req = client_request_race(f->conf, "/vdi/authmode",
+        "{\"hwaddress\": \"00:11:22:33:44:55\"}", request_result, f);
+
+    g_main_loop_run(f->loop);
+
+    g_assert_no_error(f->error);
+    JsonObject * response = json_node_get_object(f->resp);
+    g_assert_cmpstr(json_object_get_string_member(response, "status"), ==, "OK");
+    g_assert_cmpuint(mock_manager_get_requests(f->manager, "/vdi/authmode"), ==, 1);
+    // Later requests go to the endpoint that answered
+    g_autofree gchar * uri = client_conf_get_connection_uri(f->conf, "/get");
+    g_autofree gchar * expected = g_strdup_printf("https://127.0.0.1:%u/get",
+                                                  mock_manager_get_port(f->manager));
+    g_assert_cmpstr(uri, ==, expected);
+}
+
+
+static void test_client_request_desktop_pending(Fixture *f, gconstpointer user_data) {
+    const gchar * body = "{\"hwaddress\": \"00:11:22:33:44:55\", \"username\": \"user\", "
+                         "\"password\": \"secret\", \"desktop\": \"\"}";
+    int i;
+    mock_manager_set_pending(f->manager, 2);
+
+    for (i = 0; i < 3; ++i) {
+        g_clear_object(&f->req);
+        f->req = client_request_new_with_data(f->conf, "/vdi/desktop", body, request_result, f);
+        g_main_loop_run(f->loop);
+        g_assert_no_error(f->error);
+        JsonObject * response = json_node_get_object(f->resp);
+        g_assert_cmpstr(json_object_get_string_member(response, "status"), ==,
+                        i < 2 ? "Pending" : "OK");
+    }
+    g_assert_cmpuint(mock_manager_get_requests(f->manager, "/vdi/desktop"), ==, 3);
+}
+
+
+static void ws_connected(GObject * source, GAsyncResult * res, gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    SoupWebsocketConnection * conn =
+        soup_session_websocket_connect_finish(SOUP_SESSION(source), res, &f->error);
+    g_assert_no_error(f->error);
+    g_object_set_data_full(G_OBJECT(f->manager), "ws", conn, g_object_unref);
+    g_signal_connect_swapped(conn, "message", G_CALLBACK(g_main_loop_quit), f->loop);
+    soup_websocket_connection_send_binary(conn, "ping", 4);
+}
+
+
+static void test_client_request_websocket(Fixture *f, gconstpointer user_data) {
+    g_autofree gchar * uri = g_strdup_printf("wss://127.0.0.1:%u/?ver=2&token=mock-token",
+                                             mock_manager_get_port(f->manager));
+    SoupMessage * msg = soup_message_new("GET", uri);
+    soup_session_websocket_connect_async(client_conf_get_soup_session(f->conf), msg,
+                                         NULL, NULL, NULL, ws_connected, f);
+    g_main_loop_run(f->loop);
+    g_assert_cmpuint(mock_manager_get_requests(f->manager, "ws"), ==, 1);
+}
+
+
+/*
+ * Benchmark: many concurrent desktop requests, to measure request latency and
+ * the cost of parsing responses.
+ */
+#define CONCURRENT_REQUESTS 500
+
+typedef struct _BenchRequest {
+    Fixture * f;
+    gint64 start;
+    gint64 * latencies;
+    int * done;
+} BenchRequest;
+
+
+static void bench_result(ClientRequest * req, gpointer user_data) {
+    BenchRequest * br = (BenchRequest *)user_data;
+    GError * error = NULL;
+    client_request_get_result(req, &error);
+    g_assert_no_error(error);
+    br->latencies[(*br->done)++] = g_get_monotonic_time() - br->start;
+    if (*br->done == CONCURRENT_REQUESTS)
+        g_main_loop_quit(br->f->loop);
+}
+
+
+static int compare_latencies(gconstpointer a, gconstpointer b) {
+    gint64 la = *(const gint64 *)a, lb = *(const gint64 *)b;
+    return la < lb ? -1 : la > lb;
+}
+
+
+static void test_client_request_concurrent(Fixture *f, gconstpointer user_data) {
+    const gchar * body = "{\"hwaddress\": \"00:11:22:33:44:55\", \"username\": \"user\", "
+                         "\"password\": \"secret\", \"desktop\": \"\"}";
+    gint64 latencies[CONCURRENT_REQUESTS];
+    BenchRequest requests[CONCURRENT_REQUESTS];
+    ClientRequest * reqs[CONCURRENT_REQUESTS];
+    int i, done = 0;
+
+    gint64 start = g_get_monotonic_time();
+    for (i = 0; i < CONCURRENT_REQUESTS; ++i) {
+        requests[i] = (BenchRequest){ f, g_get_monotonic_time(), latencies, &done };
+        reqs[i] = client_request_new_with_data(f->conf, "/vdi/desktop", body,
+                                               bench_result, &requests[i]);
+    }
+    g_main_loop_run(f->loop);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    for (i = 0; i < CONCURRENT_REQUESTS; ++i)
+        g_object_unref(reqs[i]);
+
+    qsort(latencies, CONCURRENT_REQUESTS, sizeof(gint64), compare_latencies);
+    g_test_minimized_result(latencies[CONCURRENT_REQUESTS / 2] / 1e3,
+                            "Median request latency: %.3f ms",
+                            latencies[CONCURRENT_REQUESTS / 2] / 1e3);
+    g_test_message("95th percentile latency: %.3f ms",
+                   latencies[CONCURRENT_REQUESTS * 95 / 100] / 1e3);
+    g_test_maximized_result(CONCURRENT_REQUESTS * 1e6 / elapsed, "%.1f requests/s",
+                            CONCURRENT_REQUESTS * 1e6 / elapsed);
+
+    // JSON parse cost of a desktop response
+    const gchar * response = "{\"status\": \"OK\", \"spice_address\": \"127.0.0.1\", "
+        "\"spice_port\": \"mock-token\", \"spice_password\": \"mock-password\", "
+        "\"use_ws\": true, \"enable_power_actions\": true, \"enable_usb_redir\": true, "
+        "\"enable_printing\": true, \"inactivity_timeout\": 0}";
+    g_autoptr(JsonParser) parser = json_parser_new();
+    g_test_timer_start();
+    for (i = 0; i < 10000; ++i)
+        json_parser_load_from_data(parser, response, -1, NULL);
+    g_test_minimized_result(g_test_timer_elapsed() * 1e2, "Response parse time: %.3f us",
+                            g_test_timer_elapsed() * 1e2);
+}
+
+
 int main(int argc, char * argv[]) {
     g_test_init(&argc, &argv, NULL);
 
     g_setenv("FLEXVDI_LOG_STDERR", "1", TRUE);
     g_setenv("FLEXVDI_FATAL_LEVEL", "0", TRUE);
     client_log_setup();
-    client_log_set_log_levels("5");
+    // Debug messages would dominate the benchmark
+    client_log_set_log_levels(g_test_perf() ? "2" : "5");
 
     g_test_add("/client-request/get",
         Fixture, NULL, f_setup, test_client_request_get, f_teardown);
@@ -112,6 +278,22 @@ int main(int argc, char * argv[]) {
     g_test_add("/client-request/post",
         Fixture, NULL, f_setup, test_client_request_post, f_teardown);
 
+    g_test_add("/client-request/authmode",
+        Fixture, NULL, f_setup, test_client_request_authmode, f_teardown);
+
+    g_test_add("/client-request/failover",
+        Fixture, NULL, f_setup, test_client_request_failover, f_teardown);
+
+    g_test_add("/client-request/desktop-pending",
+        Fixture, NULL, f_setup, test_client_request_desktop_pending, f_teardown);
+
+    g_test_add("/client-request/websocket",
+        Fixture, NULL, f_setup, test_client_request_websocket, f_teardown);
+
+    if (g_test_perf())
+        g_test_add("/client-request/perf/concurrent",
+            Fixture, NULL, f_setup, test_client_request_concurrent, f_teardown);
+
     // TODO: Don't know how to check if a request has been canceled,
     // because the main loop runs forever
 
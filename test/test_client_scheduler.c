@@ -0,0 +1,141 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include "src/client-scheduler.h"
+
+
+typedef struct _Fixture {
+    ClientScheduler * scheduler;
+    GMainLoop * loop;
+    GString * order;
+    int repeats;
+    guint self_id;
+} Fixture;
+
+static void f_setup(Fixture * f, gconstpointer user_data) {
+    f->scheduler = client_scheduler_new();
+    f->loop = g_main_loop_new(NULL, FALSE);
+    f->order = g_string_new(NULL);
+    f->repeats = 0;
+}
+
+static void f_teardown(Fixture * f, gconstpointer user_data) {
+    g_clear_object(&f->scheduler);
+    g_main_loop_unref(f->loop);
+    g_string_free(f->order, TRUE);
+}
+
+
+static gboolean quit_loop(gpointer user_data) {
+    g_main_loop_quit(((Fixture *)user_data)->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean append_a(gpointer user_data) {
+    g_string_append_c(((Fixture *)user_data)->order, 'a');
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean append_b(gpointer user_data) {
+    g_string_append_c(((Fixture *)user_data)->order, 'b');
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean append_c(gpointer user_data) {
+    g_string_append_c(((Fixture *)user_data)->order, 'c');
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean repeat(gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    return ++f->repeats < 3 ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean remove_self(gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    f->repeats++;
+    client_scheduler_remove(f->scheduler, f->self_id);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void test_client_scheduler_order(Fixture * f, gconstpointer user_data) {
+    client_scheduler_add(f->scheduler, 30, append_c, f);
+    client_scheduler_add(f->scheduler, 10, append_a, f);
+    client_scheduler_add(f->scheduler, 20, append_b, f);
+    client_scheduler_add(f->scheduler, 100, quit_loop, f);
+    g_main_loop_run(f->loop);
+    g_assert_cmpstr(f->order->str, ==, "abc");
+}
+
+
+static void test_client_scheduler_remove(Fixture * f, gconstpointer user_data) {
+    client_scheduler_add(f->scheduler, 10, append_a, f);
+    guint id = client_scheduler_add(f->scheduler, 20, append_b, f);
+    client_scheduler_add(f->scheduler, 30, append_c, f);
+    g_assert_cmpuint(id, !=, 0);
+    client_scheduler_remove(f->scheduler, id);
+    // Removing twice, or unknown handles, does nothing
+    client_scheduler_remove(f->scheduler, id);
+    client_scheduler_remove(f->scheduler, 0);
+    client_scheduler_add(f->scheduler, 100, quit_loop, f);
+    g_main_loop_run(f->loop);
+    g_assert_cmpstr(f->order->str, ==, "ac");
+}
+
+
+static void test_client_scheduler_repeat(Fixture * f, gconstpointer user_data) {
+    client_scheduler_add(f->scheduler, 5, repeat, f);
+    f->self_id = client_scheduler_add(f->scheduler, 5, remove_self, f);
+    client_scheduler_add(f->scheduler, 100, quit_loop, f);
+    g_main_loop_run(f->loop);
+    // 3 repetitions, plus the single call of remove_self
+    g_assert_cmpint(f->repeats, ==, 4);
+}
+
+
+static void test_client_scheduler_seconds(Fixture * f, gconstpointer user_data) {
+    gint64 start = g_get_monotonic_time();
+    client_scheduler_add_seconds(f->scheduler, 1, quit_loop, f);
+    g_main_loop_run(f->loop);
+    gint64 end = g_get_monotonic_time();
+    g_assert_cmpint(end - start, >=, G_USEC_PER_SEC);
+    // Rounded up to a whole second at most
+    g_assert_cmpint(end - start, <, 3 * G_USEC_PER_SEC);
+}
+
+
+int main(int argc, char * argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/client-scheduler/order",
+        Fixture, NULL, f_setup, test_client_scheduler_order, f_teardown);
+
+    g_test_add("/client-scheduler/remove",
+        Fixture, NULL, f_setup, test_client_scheduler_remove, f_teardown);
+
+    g_test_add("/client-scheduler/repeat",
+        Fixture, NULL, f_setup, test_client_scheduler_repeat, f_teardown);
+
+    g_test_add("/client-scheduler/seconds",
+        Fixture, NULL, f_setup, test_client_scheduler_seconds, f_teardown);
+
+    return g_test_run();
+}
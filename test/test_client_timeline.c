@@ -0,0 +1,64 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include "src/client-timeline.h"
+
+
+void test_client_timeline() {
+    client_timeline_reset();
+    gint64 start = g_get_monotonic_time();
+    client_timeline_mark("channel %d opened", 1);
+    g_usleep(2000);
+    client_timeline_span(start, "request");
+
+    g_autofree gchar * json = client_timeline_to_json();
+    g_autoptr(JsonParser) parser = json_parser_new();
+    g_assert_true(json_parser_load_from_data(parser, json, -1, NULL));
+    JsonObject * root = json_node_get_object(json_parser_get_root(parser));
+    JsonArray * events = json_object_get_array_member(root, "traceEvents");
+    g_assert_cmpint(json_array_get_length(events), ==, 2);
+
+    JsonObject * mark = json_array_get_object_element(events, 0);
+    g_assert_cmpstr(json_object_get_string_member(mark, "name"), ==, "channel 1 opened");
+    g_assert_cmpstr(json_object_get_string_member(mark, "ph"), ==, "i");
+    g_assert_false(json_object_has_member(mark, "dur"));
+
+    JsonObject * span = json_array_get_object_element(events, 1);
+    g_assert_cmpstr(json_object_get_string_member(span, "name"), ==, "request");
+    g_assert_cmpstr(json_object_get_string_member(span, "ph"), ==, "X");
+    g_assert_cmpint(json_object_get_int_member(span, "dur"), >=, 2000);
+    g_assert_cmpint(json_object_get_int_member(span, "ts"), >=, 0);
+
+    // A new connection starts a new timeline
+    client_timeline_reset();
+    g_free(json);
+    json = client_timeline_to_json();
+    g_assert_nonnull(strstr(json, "\"traceEvents\":[]"));
+}
+
+int main(int argc, char * argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/misc/client_timeline", test_client_timeline);
+
+    return g_test_run();
+}
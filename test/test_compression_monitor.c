@@ -0,0 +1,190 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "src/compression-monitor.h"
+
+
+typedef struct _Fixture {
+    SpiceSession * session;
+    CompressionMonitor * monitor;
+} Fixture;
+
+static void f_setup(Fixture * f, gconstpointer user_data) {
+    f->session = spice_session_new();
+    f->monitor = compression_monitor_new(f->session, NULL, NULL, NULL);
+}
+
+static void f_teardown(Fixture * f, gconstpointer user_data) {
+    g_clear_object(&f->monitor);
+    g_clear_object(&f->session);
+}
+
+
+#define MBIT(x) ((x) * 1000000 / 8)
+#define MS(x) ((x) * 1000)
+
+/*
+ * Feed samples of one second at a certain bandwidth, with the round trip time of
+ * the link in each sample, and return the last decision other than keeping the
+ * current one.
+ */
+static gint feed_rtt(Fixture * f, gint64 rate, int samples, gint64 rtt) {
+    gint result = SPICE_IMAGE_COMPRESSION_INVALID;
+    for (; samples > 0; --samples) {
+        gint compression = compression_monitor_add_sample(f->monitor, rate, G_USEC_PER_SEC, rtt);
+        if (compression != SPICE_IMAGE_COMPRESSION_INVALID)
+            result = compression;
+    }
+    return result;
+}
+
+static gint feed(Fixture * f, gint64 rate, int samples) {
+    return feed_rtt(f, rate, samples, -1);
+}
+
+
+static void test_compression_monitor_fast(Fixture * f, gconstpointer user_data) {
+    g_assert_cmpint(feed(f, MBIT(100), 1), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    g_assert_cmpint(feed(f, MBIT(100), 1), ==, SPICE_IMAGE_COMPRESSION_LZ4);
+    // Already using lz4
+    g_assert_cmpint(feed(f, MBIT(100), 50), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+}
+
+
+static void test_compression_monitor_low_traffic(Fixture * f, gconstpointer user_data) {
+    int i;
+    // Office work on a LAN: little traffic, but the round trip time stays low
+    g_assert_cmpint(feed_rtt(f, MBIT(4), 100, MS(1)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    // Without the round trip time, bursts and pauses are not a capped link either
+    for (i = 0; i < 50; ++i) {
+        g_assert_cmpint(feed(f, MBIT(4), 1), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+        g_assert_cmpint(feed(f, MBIT(1), 1), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    }
+}
+
+
+static void test_compression_monitor_rtt(Fixture * f, gconstpointer user_data) {
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 10, MS(10)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    // Jitter below the margin
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 10, MS(35)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    // Packets wait in a queue along the path
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 2, MS(80)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 1, MS(80)), ==, SPICE_IMAGE_COMPRESSION_AUTO_GLZ);
+}
+
+
+static void test_compression_monitor_long_rtt(Fixture * f, gconstpointer user_data) {
+    // A long path that does not get worse is not saturated
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 100, MS(150)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+}
+
+
+static void test_compression_monitor_plateau(Fixture * f, gconstpointer user_data) {
+    int i;
+    // Without the round trip time, a busy display whose throughput does not grow
+    for (i = 0; i < 11; ++i)
+        g_assert_cmpint(feed(f, MBIT(i % 2 ? 8 : 9), 1), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    g_assert_cmpint(feed(f, MBIT(8), 1), ==, SPICE_IMAGE_COMPRESSION_AUTO_GLZ);
+}
+
+
+static void test_compression_monitor_idle(Fixture * f, gconstpointer user_data) {
+    // An idle desktop says nothing about the link
+    g_assert_cmpint(feed(f, 1000, 100), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    g_assert_cmpint(feed(f, 0, 100), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+}
+
+
+static void test_compression_monitor_hysteresis(Fixture * f, gconstpointer user_data) {
+    g_assert_cmpint(feed_rtt(f, MBIT(100), 2, MS(1)), ==, SPICE_IMAGE_COMPRESSION_LZ4);
+    // The link gets saturated, but the last switch is too recent
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 30, MS(50)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+    g_assert_cmpint(feed_rtt(f, MBIT(8), 1, MS(50)), ==, SPICE_IMAGE_COMPRESSION_AUTO_GLZ);
+    // Once the round trip time recovers, traffic below the fast rate does not switch
+    g_assert_cmpint(feed_rtt(f, MBIT(15), 100, MS(1)), ==, SPICE_IMAGE_COMPRESSION_INVALID);
+}
+
+
+/*
+ * The round trip time comes from the kernel, check that it is really there on a
+ * loopback connection.
+ */
+static void test_compression_monitor_socket_rtt(void) {
+#if defined(__linux__) || defined(__APPLE__)
+    g_autoptr(GSocketListener) listener = g_socket_listener_new();
+    g_autoptr(GSocketClient) client = g_socket_client_new();
+    g_autoptr(GSocketConnection) local = NULL;
+    g_autoptr(GSocketConnection) remote = NULL;
+    g_autoptr(GError) error = NULL;
+    gchar buffer[64];
+    guint16 port;
+    int i;
+
+    port = g_socket_listener_add_any_inet_port(listener, NULL, &error);
+    g_assert_no_error(error);
+    local = g_socket_client_connect_to_host(client, "127.0.0.1", port, NULL, &error);
+    g_assert_no_error(error);
+    remote = g_socket_listener_accept(listener, NULL, NULL, &error);
+    g_assert_no_error(error);
+    GSocket * local_socket = g_socket_connection_get_socket(local);
+    GSocket * remote_socket = g_socket_connection_get_socket(remote);
+    for (i = 0; i < 10; ++i) {
+        g_assert_cmpint(g_socket_send(local_socket, "ping", 4, NULL, &error), ==, 4);
+        g_assert_cmpint(g_socket_receive(remote_socket, buffer, 4, NULL, &error), ==, 4);
+        g_assert_cmpint(g_socket_send(remote_socket, "pong", 4, NULL, &error), ==, 4);
+        g_assert_cmpint(g_socket_receive(local_socket, buffer, 4, NULL, &error), ==, 4);
+    }
+    g_assert_cmpint(compression_monitor_get_socket_rtt(local_socket), >=, 0);
+    g_assert_cmpint(compression_monitor_get_socket_rtt(local_socket), <, G_USEC_PER_SEC);
+#else
+    g_test_skip("The platform does not report the round trip time of sockets");
+#endif
+}
+
+
+int main(int argc, char * argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/compression-monitor/fast",
+        Fixture, NULL, f_setup, test_compression_monitor_fast, f_teardown);
+
+    g_test_add("/compression-monitor/low-traffic",
+        Fixture, NULL, f_setup, test_compression_monitor_low_traffic, f_teardown);
+
+    g_test_add("/compression-monitor/rtt",
+        Fixture, NULL, f_setup, test_compression_monitor_rtt, f_teardown);
+
+    g_test_add("/compression-monitor/long-rtt",
+        Fixture, NULL, f_setup, test_compression_monitor_long_rtt, f_teardown);
+
+    g_test_add("/compression-monitor/plateau",
+        Fixture, NULL, f_setup, test_compression_monitor_plateau, f_teardown);
+
+    g_test_add("/compression-monitor/idle",
+        Fixture, NULL, f_setup, test_compression_monitor_idle, f_teardown);
+
+    g_test_add("/compression-monitor/hysteresis",
+        Fixture, NULL, f_setup, test_compression_monitor_hysteresis, f_teardown);
+
+    g_test_add_func("/compression-monitor/socket-rtt", test_compression_monitor_socket_rtt);
+
+    return g_test_run();
+}
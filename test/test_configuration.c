@@ -0,0 +1,128 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "src/configuration.h"
+
+
+typedef struct _Fixture {
+    gchar * dir;
+    gchar * file_name;
+    ClientConf * conf;
+} Fixture;
+
+static void f_setup(Fixture * f, gconstpointer user_data) {
+    f->dir = g_strdup(g_get_user_config_dir());
+    f->file_name = g_build_filename(f->dir, "flexvdi-client", "settings.ini", NULL);
+    g_unlink(f->file_name);
+    f->conf = client_conf_new();
+}
+
+static void f_teardown(Fixture * f, gconstpointer user_data) {
+    g_clear_object(&f->conf);
+    g_unlink(f->file_name);
+    g_free(f->file_name);
+    g_free(f->dir);
+}
+
+
+static gboolean quit_loop(gpointer user_data) {
+    g_main_loop_quit((GMainLoop *)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void test_configuration_debounced_save(Fixture * f, gconstpointer user_data) {
+    int i, width, height, monitor;
+    gboolean maximized;
+
+    // Like dragging a window border
+    for (i = 0; i < 100; ++i)
+        client_conf_set_window_size(f->conf, 0, 800 + i, 600 + i, FALSE, 1);
+    g_assert_false(g_file_test(f->file_name, G_FILE_TEST_EXISTS));
+    g_assert_true(client_conf_get_window_size(f->conf, 0, &width, &height, &maximized, &monitor));
+    g_assert_cmpint(width, ==, 899);
+    g_assert_cmpint(height, ==, 699);
+    g_assert_false(maximized);
+    g_assert_cmpint(monitor, ==, 1);
+
+    g_autoptr(GMainLoop) loop = g_main_loop_new(NULL, FALSE);
+    g_timeout_add(1500, quit_loop, loop);
+    g_main_loop_run(loop);
+
+    g_autofree gchar * contents = NULL;
+    g_assert_true(g_file_get_contents(f->file_name, &contents, NULL, NULL));
+    g_assert_nonnull(strstr(contents, "[Layout]"));
+    g_assert_nonnull(strstr(contents, "0=899,699,false,1"));
+}
+
+
+static void test_configuration_save_unchanged(Fixture * f, gconstpointer user_data) {
+    client_conf_set_window_size(f->conf, 0, 800, 600, TRUE, 0);
+    client_conf_save(f->conf);
+    g_assert_true(g_file_test(f->file_name, G_FILE_TEST_EXISTS));
+
+    // Nothing changed, nothing is written
+    g_unlink(f->file_name);
+    client_conf_set_window_size(f->conf, 0, 800, 600, TRUE, 0);
+    client_conf_save(f->conf);
+    g_assert_false(g_file_test(f->file_name, G_FILE_TEST_EXISTS));
+}
+
+
+static void test_configuration_share_printer(Fixture * f, gconstpointer user_data) {
+    client_conf_share_printer(f->conf, "printer1", TRUE);
+    client_conf_share_printer(f->conf, "printer2", TRUE);
+    client_conf_share_printer(f->conf, "printer2", TRUE);
+    client_conf_share_printer(f->conf, "printer1", FALSE);
+    g_assert_false(client_conf_is_printer_shared(f->conf, "printer1"));
+    g_assert_true(client_conf_is_printer_shared(f->conf, "printer2"));
+
+    // Pending changes are saved when the configuration is destroyed
+    g_clear_object(&f->conf);
+    g_autofree gchar * contents = NULL;
+    g_assert_true(g_file_get_contents(f->file_name, &contents, NULL, NULL));
+    g_assert_nonnull(strstr(contents, "share-printer=printer2;"));
+}
+
+
+int main(int argc, char * argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    // Keep the user's settings safe
+    g_autofree gchar * config_dir = g_dir_make_tmp("flexvdi-test-XXXXXX", NULL);
+    g_setenv("XDG_CONFIG_HOME", config_dir, TRUE);
+
+    g_test_add("/configuration/debounced-save",
+        Fixture, NULL, f_setup, test_configuration_debounced_save, f_teardown);
+
+    g_test_add("/configuration/save-unchanged",
+        Fixture, NULL, f_setup, test_configuration_save_unchanged, f_teardown);
+
+    g_test_add("/configuration/share-printer",
+        Fixture, NULL, f_setup, test_configuration_share_printer, f_teardown);
+
+    int result = g_test_run();
+    g_autofree gchar * settings_dir = g_build_filename(config_dir, "flexvdi-client", NULL);
+    g_rmdir(settings_dir);
+    g_rmdir(config_dir);
+    return result;
+}
@@ -0,0 +1,317 @@
+/*
+    Copyright (C) 2014-2018 Flexible Software Solutions S.L.U.
+
+    This file is part of flexVDI Client.
+
+    flexVDI Client is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    flexVDI Client is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with flexVDI Client. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pty.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "src/serialredir.h"
+#include "src/serialredir-priv.h"
+
+/*
+ * Tests and benchmarks of the serial redirection, with a pseudo-terminal as the
+ * serial device. The test plays the role of the device on the master side, and
+ * of the guest through a sink that replaces the port channel. A pseudo-terminal
+ * ignores the line speed, so the benchmarks measure the overhead of the
+ * redirection in each mode, not the behaviour at a given baud rate.
+ */
+
+#define TEST_SIZE (256 * 1024)
+#define TEST_TIMEOUT 10
+
+typedef struct Fixture {
+    int master, slave;
+    gchar * params[2];
+    GMainLoop * loop;
+    GByteArray * received;
+    gsize expected;
+    guint sink_calls;
+    gint64 last_arrival;
+    guint timeout_id;
+} Fixture;
+
+typedef struct TestCase {
+    int speed;
+    gboolean low_latency;
+} TestCase;
+
+
+static guint8 pattern(gsize i) {
+    return (i * 7 + i / 251) & 0xff;
+}
+
+
+static gboolean timeout_cb(gpointer user_data) {
+    g_error("Timed out");
+    return G_SOURCE_REMOVE;
+}
+
+
+static void fixture_setup(Fixture * f, gconstpointer user_data) {
+    const TestCase * tc = (const TestCase *)user_data;
+    char name[256];
+    g_assert_cmpint(openpty(&f->master, &f->slave, name, NULL, NULL), ==, 0);
+    f->params[0] = g_strdup_printf("%s,%d,8N1", name, tc->speed);
+    f->params[1] = NULL;
+    f->loop = g_main_loop_new(NULL, FALSE);
+    f->received = g_byte_array_new();
+    f->timeout_id = g_timeout_add_seconds(TEST_TIMEOUT, timeout_cb, NULL);
+
+    SerialPortOptions options = {
+        .params = f->params,
+        .buffer_size = 4096,
+        .latency = 5,
+        .low_latency = tc->low_latency,
+        .vmin = 1,
+        .vtime = 0,
+    };
+    serial_port_init_with_options(&options);
+}
+
+
+static void fixture_teardown(Fixture * f, gconstpointer user_data) {
+    serial_port_close(0);
+    g_source_remove(f->timeout_id);
+    g_byte_array_unref(f->received);
+    g_main_loop_unref(f->loop);
+    g_free(f->params[0]);
+    close(f->master);
+    close(f->slave);
+}
+
+
+static void guest_sink(int port_number, const guint8 * data, gsize size, gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    g_assert_cmpint(port_number, ==, 0);
+    g_byte_array_append(f->received, data, size);
+    f->sink_calls++;
+    f->last_arrival = g_get_monotonic_time();
+    if (f->received->len >= f->expected)
+        g_main_loop_quit(f->loop);
+}
+
+
+static gpointer device_writer_thread(gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    guint8 * data = g_malloc(f->expected);
+    gsize i, written = 0;
+    for (i = 0; i < f->expected; ++i) data[i] = pattern(i);
+    while (written < f->expected) {
+        // Small writes, like a real device would produce
+        ssize_t size = write(f->master, data + written, MIN(64, f->expected - written));
+        if (size < 0 && errno == EINTR) continue;
+        g_assert_cmpint(size, >, 0);
+        written += size;
+    }
+    g_free(data);
+    return NULL;
+}
+
+
+static void check_received(Fixture * f) {
+    gsize i;
+    g_assert_cmpuint(f->received->len, ==, f->expected);
+    for (i = 0; i < f->expected; ++i)
+        if (f->received->data[i] != pattern(i))
+            g_error("Data out of order at byte %" G_GSIZE_FORMAT, i);
+}
+
+
+static void test_device_to_guest(Fixture * f, gconstpointer user_data) {
+    f->expected = TEST_SIZE;
+    serial_port_open_with_sink(0, guest_sink, f);
+    GThread * writer = g_thread_new("device", device_writer_thread, f);
+    gint64 start = g_get_monotonic_time();
+    g_main_loop_run(f->loop);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_thread_join(writer);
+
+    check_received(f);
+    // Device data must be coalesced into fewer port writes
+    g_assert_cmpuint(f->sink_calls, <, f->expected / 64);
+
+    if (g_test_perf()) {
+        g_test_maximized_result(f->expected * 1e6 / MAX(elapsed, 1),
+                                "Device to guest throughput: %.0f bytes/s",
+                                f->expected * 1e6 / MAX(elapsed, 1));
+        g_test_message("%u port writes for %" G_GSIZE_FORMAT " bytes",
+                       f->sink_calls, f->expected);
+    }
+}
+
+
+static gboolean device_read_cb(gint fd, GIOCondition condition, gpointer user_data) {
+    Fixture * f = (Fixture *)user_data;
+    guint8 buffer[4096];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size > 0) {
+        g_byte_array_append(f->received, buffer, size);
+        if (f->received->len >= f->expected)
+            g_main_loop_quit(f->loop);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void test_guest_to_device(Fixture * f, gconstpointer user_data) {
+    gsize i, sent;
+    guint8 * data = g_malloc(TEST_SIZE);
+    SerialPortStats stats;
+    for (i = 0; i < TEST_SIZE; ++i) data[i] = pattern(i);
+    f->expected = TEST_SIZE;
+    serial_port_open_with_sink(0, guest_sink, f);
+    fcntl(f->master, F_SETFL, fcntl(f->master, F_GETFL) | O_NONBLOCK);
+    guint watch = g_unix_fd_add(f->master, G_IO_IN, device_read_cb, f);
+
+    gint64 start = g_get_monotonic_time();
+    // Guest messages, much faster than the device can take them
+    for (sent = 0; sent < TEST_SIZE; sent += 1024)
+        serial_port_guest_data(0, data + sent, MIN(1024, TEST_SIZE - sent));
+    g_main_loop_run(f->loop);
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_source_remove(watch);
+
+    check_received(f);
+    g_assert_true(serial_port_get_stats(0, &stats));
+    g_assert_cmpuint(stats.written_bytes, ==, TEST_SIZE);
+    g_assert_cmpuint(stats.dropped_bytes, ==, 0);
+    g_assert_cmpuint(stats.queued_bytes, ==, 0);
+
+    if (g_test_perf()) {
+        g_test_maximized_result(TEST_SIZE * 1e6 / MAX(elapsed, 1),
+                                "Guest to device throughput: %.0f bytes/s",
+                                TEST_SIZE * 1e6 / MAX(elapsed, 1));
+        g_test_message("Maximum queued data: %" G_GSIZE_FORMAT " bytes, %" G_GUINT64_FORMAT
+                       " writes", stats.max_queued_bytes, stats.writes);
+    }
+    g_free(data);
+}
+
+
+static void test_guest_to_device_overflow(Fixture * f, gconstpointer user_data) {
+    const gsize chunk = 1000;
+    gsize i, sent = 0, size = 4 * 1024 * 1024;
+    guint8 * data = g_malloc(size);
+    SerialPortStats stats;
+    for (i = 0; i < size; ++i) data[i] = pattern(i);
+    serial_port_open_with_sink(0, guest_sink, f);
+    fcntl(f->master, F_SETFL, fcntl(f->master, F_GETFL) | O_NONBLOCK);
+
+    // Nobody reads the device, fill the queue until it overflows
+    do {
+        g_assert_cmpuint(sent + chunk, <=, size);
+        serial_port_guest_data(0, data + sent, chunk);
+        sent += chunk;
+        g_assert_true(serial_port_get_stats(0, &stats));
+    } while (stats.dropped_bytes == 0);
+    // A smaller chunk would fit, but it would leave a hole in the stream
+    serial_port_guest_data(0, data + sent, 1);
+    sent += 1;
+    g_assert_true(serial_port_get_stats(0, &stats));
+    g_assert_cmpuint(stats.dropped_bytes, ==, chunk + 1);
+
+    // The device gets what was accepted, without holes
+    f->expected = sent - stats.dropped_bytes;
+    guint watch = g_unix_fd_add(f->master, G_IO_IN, device_read_cb, f);
+    g_main_loop_run(f->loop);
+    check_received(f);
+    // The last write may complete after the device has read it
+    g_assert_true(serial_port_get_stats(0, &stats));
+    while (stats.queued_bytes > 0) {
+        g_main_context_iteration(NULL, TRUE);
+        g_assert_true(serial_port_get_stats(0, &stats));
+    }
+
+    // Once the device catches up, the guest data goes through again
+    serial_port_guest_data(0, data + f->expected, chunk);
+    f->expected += chunk;
+    g_main_loop_run(f->loop);
+    g_source_remove(watch);
+    check_received(f);
+    g_assert_true(serial_port_get_stats(0, &stats));
+    g_assert_cmpuint(stats.dropped_bytes, ==, chunk + 1);
+    g_free(data);
+}
+
+
+static gboolean quit_cb(gpointer user_data) {
+    g_main_loop_quit((GMainLoop *)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void test_latency(Fixture * f, gconstpointer user_data) {
+    const int rounds = 200;
+    gint64 total = 0, worst = 0;
+    int i;
+    serial_port_open_with_sink(0, guest_sink, f);
+    // Let the reader settle
+    g_timeout_add(10, quit_cb, f->loop);
+    g_main_loop_run(f->loop);
+
+    for (i = 0; i < rounds; ++i) {
+        guint8 byte = pattern(i);
+        f->expected = i + 1;
+        gint64 start = g_get_monotonic_time();
+        g_assert_cmpint(write(f->master, &byte, 1), ==, 1);
+        g_main_loop_run(f->loop);
+        gint64 latency = f->last_arrival - start;
+        total += latency;
+        worst = MAX(worst, latency);
+    }
+    check_received(f);
+
+    g_test_minimized_result(total / 1e3 / rounds, "Mean byte latency: %.3f ms",
+                            total / 1e3 / rounds);
+    g_test_message("Worst byte latency: %.3f ms", worst / 1e3);
+}
+
+
+int main(int argc, char * argv[]) {
+    static const TestCase modes[] = { { 115200, FALSE }, { 115200, TRUE } };
+    int i;
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/serialredir/device-to-guest", Fixture, &modes[0],
+               fixture_setup, test_device_to_guest, fixture_teardown);
+    g_test_add("/serialredir/device-to-guest-low-latency", Fixture, &modes[1],
+               fixture_setup, test_device_to_guest, fixture_teardown);
+    g_test_add("/serialredir/guest-to-device", Fixture, &modes[0],
+               fixture_setup, test_guest_to_device, fixture_teardown);
+    g_test_add("/serialredir/guest-to-device-overflow", Fixture, &modes[0],
+               fixture_setup, test_guest_to_device_overflow, fixture_teardown);
+
+    if (g_test_perf()) {
+        for (i = 0; i < G_N_ELEMENTS(modes); ++i) {
+            const char * mode = modes[i].low_latency ? "low-latency" : "default";
+            g_autofree gchar * throughput = g_strdup_printf(
+                "/serialredir/perf/%s/throughput", mode);
+            g_autofree gchar * latency = g_strdup_printf(
+                "/serialredir/perf/%s/latency", mode);
+            g_test_add(throughput, Fixture, &modes[i],
+                       fixture_setup, test_device_to_guest, fixture_teardown);
+            g_test_add(latency, Fixture, &modes[i],
+                       fixture_setup, test_latency, fixture_teardown);
+        }
+    }
+
+    return g_test_run();
+}